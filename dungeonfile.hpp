@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+
+#include "fileutil.hpp"
+
+// binary dungeon file, little-endian, every section starts on an 8 byte boundary:
+//   DungeonFileHeader
+//   DungeonFileRoom[room_count]
+//   DungeonFileCorridor[corridor_count]
+//   unsigned int offsets[room_count + 1], targets[edge_count]	the room graph as CSR
+// the records are read in place from the mapping, so a file only loads on a little-endian host
+const char DungeonFileMagic[4] = { 'R', 'L', 'D', 'G' };
+const unsigned int DungeonFileVersion = 1;
+
+struct DungeonFileHeader{
+	char magic[4];
+	unsigned int version;
+	unsigned long long seed;	// Graph::Seed before the generation that made this layout
+	unsigned long long layout_hash;	// Graph::GetLayoutHash
+	unsigned int room_count, corridor_count, edge_count, reserved;
+	unsigned long long payload_size;	// bytes after the header
+	unsigned long long payload_checksum;
+	unsigned long long header_checksum;	// over the bytes above
+};
+
+struct DungeonFileRoom{
+	unsigned int tile_id;
+	unsigned int locate;	// LocateMode
+	int pivot_x, pivot_y;
+	int x, y, h, w;	// the located rect
+};
+
+struct DungeonFileCorridor{
+	int start_x, start_y, end_x, end_y;	// the door cells at both ends, a straight run along a row or a column
+};
+
+static_assert(sizeof(DungeonFileHeader) == 64, "DungeonFileHeader must not have padding");
+static_assert(sizeof(DungeonFileRoom) == 32, "DungeonFileRoom must not have padding");
+static_assert(sizeof(DungeonFileCorridor) == 16, "DungeonFileCorridor must not have padding");
+
+// a dungeon file opened for reading, every accessor points into the mapping, so opening
+// costs the validation only, no parsing and no per-room allocation. The validation covers
+// whatever an accessor indexes with, so a view of a crafted file never reads past the mapping
+class DungeonView{
+	MappedFile m_file;
+	const DungeonFileHeader *m_header;
+	const DungeonFileRoom *m_rooms;
+	const DungeonFileCorridor *m_corridors;
+	const unsigned int *m_offsets;
+	const unsigned int *m_targets;
+public:
+	DungeonView() : m_header(NULL), m_rooms(NULL), m_corridors(NULL), m_offsets(NULL), m_targets(NULL) { }
+	bool Open(const char *path, bool verify_payload = true);	// false when missing, truncated, corrupt or from another version
+	void Close();
+	bool IsOpen() const { return m_header != NULL; }
+	size_t GetFileSize() const { return m_file.GetSize(); }
+	unsigned long long GetSeed() const { return m_header->seed; }
+	unsigned long long GetLayoutHash() const { return m_header->layout_hash; }
+	unsigned int GetRoomCount() const { return m_header->room_count; }
+	unsigned int GetCorridorCount() const { return m_header->corridor_count; }
+	const DungeonFileRoom& GetRoom(unsigned int i) const { return m_rooms[i]; }
+	const DungeonFileCorridor& GetCorridor(unsigned int i) const { return m_corridors[i]; }
+	unsigned int GetDegree(unsigned int i) const { return m_offsets[i + 1] - m_offsets[i]; }
+	const unsigned int* GetNeighbors(unsigned int i) const { return m_targets + m_offsets[i]; }
+private:
+	bool CheckSections(const DungeonFileHeader *header) const;
+};
+
+inline bool DungeonView::Open(const char *path, bool verify_payload)
+{
+	Close();
+	if (!IsLittleEndian() || !m_file.Open(path) || m_file.GetSize() < sizeof(DungeonFileHeader)) {
+		Close();
+		return false;
+	}
+
+	const unsigned char *data = m_file.GetData();
+	const DungeonFileHeader *header = (const DungeonFileHeader*)data;
+	if (memcmp(header->magic, DungeonFileMagic, sizeof(DungeonFileMagic)) != 0 || header->version != DungeonFileVersion
+		|| FileChecksum(header, offsetof(DungeonFileHeader, header_checksum)) != header->header_checksum) {
+		Close();
+		return false;
+	}
+
+	// the sizes come from a checked header, but still must not run past the mapping
+	size_t rooms_size = AlignFileSection((size_t)header->room_count * sizeof(DungeonFileRoom));
+	size_t corridors_size = AlignFileSection((size_t)header->corridor_count * sizeof(DungeonFileCorridor));
+	size_t graph_size = AlignFileSection(((size_t)header->room_count + 1 + header->edge_count) * sizeof(unsigned int));
+	if (header->payload_size != rooms_size + corridors_size + graph_size
+		|| header->payload_size != m_file.GetSize() - sizeof(DungeonFileHeader)) {
+		Close();
+		return false;
+	}
+	const unsigned char *payload = data + sizeof(DungeonFileHeader);
+	if (verify_payload && FileChecksum(payload, (size_t)header->payload_size) != header->payload_checksum) {
+		Close();
+		return false;
+	}
+
+	m_rooms = (const DungeonFileRoom*)payload;
+	m_corridors = (const DungeonFileCorridor*)(payload + rooms_size);
+	m_offsets = (const unsigned int*)(payload + rooms_size + corridors_size);
+	m_targets = m_offsets + header->room_count + 1;
+	if (!CheckSections(header)) {
+		Close();
+		return false;
+	}
+	m_header = header;
+	return true;
+}
+
+// the room graph must be a CSR of rooms in this file and every corridor a straight run
+inline bool DungeonView::CheckSections(const DungeonFileHeader *header) const
+{
+	const unsigned int room_count = header->room_count;
+	if (m_offsets[0] != 0 || m_offsets[room_count] != header->edge_count) {
+		return false;
+	}
+	for (unsigned int i = 0; i < room_count; ++i) {
+		if (m_offsets[i + 1] < m_offsets[i]) {
+			return false;
+		}
+	}
+	for (unsigned int i = 0; i < header->edge_count; ++i) {
+		if (m_targets[i] >= room_count) {
+			return false;
+		}
+	}
+	for (unsigned int i = 0; i < header->corridor_count; ++i) {
+		const DungeonFileCorridor &corridor = m_corridors[i];
+		if (corridor.start_x != corridor.end_x && corridor.start_y != corridor.end_y) {
+			return false;
+		}
+	}
+	return true;
+}
+
+inline void DungeonView::Close()
+{
+	m_file.Close();
+	m_header = NULL;
+	m_rooms = NULL;
+	m_corridors = NULL;
+	m_offsets = NULL;
+	m_targets = NULL;
+}
@@ -0,0 +1,225 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+inline bool IsLittleEndian()
+{
+	const unsigned int one = 1;
+	return *(const unsigned char*)&one == 1;
+}
+
+inline size_t AlignFileSection(size_t size)
+{
+	return (size + 7) & ~(size_t)7;
+}
+
+// FNV-1a over 8 byte words with the tail zero padded, size need not be a multiple of 8
+inline unsigned long long FileChecksum(const void *data, size_t size)
+{
+	const unsigned char *bytes = (const unsigned char*)data;
+	unsigned long long hash = 14695981039346656037ULL;
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		unsigned long long word;
+		memcpy(&word, bytes + i, 8);
+		hash = (hash ^ word) * 1099511628211ULL;
+	}
+	if (i < size) {
+		unsigned long long word = 0;
+		memcpy(&word, bytes + i, size - i);
+		hash = (hash ^ word) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+// a whole file mapped read only
+class MappedFile{
+	const unsigned char *m_data;
+	size_t m_size;
+#ifdef _WIN32
+	HANDLE m_file, m_mapping;
+#endif
+private:
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+public:
+	MappedFile();
+	~MappedFile();
+	bool Open(const char *path);
+	void Close();
+	void Swap(MappedFile &file);
+	const unsigned char* GetData() const { return m_data; }
+	size_t GetSize() const { return m_size; }
+};
+
+#ifdef _WIN32
+inline MappedFile::MappedFile() : m_data(NULL), m_size(0), m_file(INVALID_HANDLE_VALUE), m_mapping(NULL)
+{
+}
+#else
+inline MappedFile::MappedFile() : m_data(NULL), m_size(0)
+{
+}
+#endif
+
+inline MappedFile::~MappedFile()
+{
+	Close();
+}
+
+inline bool MappedFile::Open(const char *path)
+{
+	Close();
+#ifdef _WIN32
+	m_file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (m_file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(m_file, &size) || size.QuadPart == 0) {
+		Close();
+		return false;
+	}
+	m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (m_mapping == NULL) {
+		Close();
+		return false;
+	}
+	m_data = (const unsigned char*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+	if (m_data == NULL) {
+		Close();
+		return false;
+	}
+	m_size = (size_t)size.QuadPart;
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return false;
+	}
+	void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);	// the mapping keeps the file alive
+	if (data == MAP_FAILED) {
+		return false;
+	}
+	m_data = (const unsigned char*)data;
+	m_size = (size_t)st.st_size;
+#endif
+	return true;
+}
+
+inline void MappedFile::Swap(MappedFile &file)
+{
+	std::swap(m_data, file.m_data);
+	std::swap(m_size, file.m_size);
+#ifdef _WIN32
+	std::swap(m_file, file.m_file);
+	std::swap(m_mapping, file.m_mapping);
+#endif
+}
+
+inline void MappedFile::Close()
+{
+#ifdef _WIN32
+	if (m_data != NULL) {
+		UnmapViewOfFile(m_data);
+	}
+	if (m_mapping != NULL) {
+		CloseHandle(m_mapping);
+	}
+	if (m_file != INVALID_HANDLE_VALUE) {
+		CloseHandle(m_file);
+	}
+	m_mapping = NULL;
+	m_file = INVALID_HANDLE_VALUE;
+#else
+	if (m_data != NULL) {
+		munmap((void*)m_data, m_size);
+	}
+#endif
+	m_data = NULL;
+	m_size = 0;
+}
+
+struct FileInfo{
+	std::string name;	// without the directory
+	unsigned long long size;
+	unsigned long long mtime;	// in whatever unit the platform keeps, only compared for equality
+};
+
+typedef std::vector<FileInfo> FileInfoVec;
+
+// the regular files directly in "dir" whose name ends with "suffix", sorted by name.
+// false when the directory cannot be read
+inline bool ListFiles(const char *dir, const char *suffix, FileInfoVec &files)
+{
+	files.clear();
+	const size_t suffix_len = strlen(suffix);
+#ifdef _WIN32
+	std::string pattern = std::string(dir) + "\\*";
+	WIN32_FIND_DATAA data;
+	HANDLE find = FindFirstFileA(pattern.c_str(), &data);
+	if (find == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	do {
+		size_t len = strlen(data.cFileName);
+		if ((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) || len < suffix_len
+			|| strcmp(data.cFileName + len - suffix_len, suffix) != 0) {
+			continue;
+		}
+		FileInfo info;
+		info.name = data.cFileName;
+		info.size = ((unsigned long long)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+		info.mtime = ((unsigned long long)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+		files.push_back(info);
+	} while (FindNextFileA(find, &data));
+	FindClose(find);
+#else
+	DIR *handle = opendir(dir);
+	if (handle == NULL) {
+		return false;
+	}
+	struct dirent *entry;
+	while ((entry = readdir(handle)) != NULL) {
+		size_t len = strlen(entry->d_name);
+		if (len < suffix_len || strcmp(entry->d_name + len - suffix_len, suffix) != 0) {
+			continue;
+		}
+		std::string path = std::string(dir) + "/" + entry->d_name;
+		struct stat st;
+		if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+			continue;
+		}
+		FileInfo info;
+		info.name = entry->d_name;
+		info.size = (unsigned long long)st.st_size;
+		info.mtime = (unsigned long long)st.st_mtime;
+		files.push_back(info);
+	}
+	closedir(handle);
+#endif
+	std::sort(files.begin(), files.end(), [](const FileInfo &l, const FileInfo &r) { return l.name < r.name; });
+	return true;
+}
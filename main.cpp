@@ -1,6 +1,9 @@
-#include <windows.h>
-
+#include <algorithm>
 #include <cassert>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
 #include <ctime>
 #include <cstdlib>
 #include <iomanip>
@@ -8,18 +11,73 @@
 #include <string>
 #include <vector>
 #include <bitset>
-#include <queue>
+#include <functional>
+#include <map>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <condition_variable>
+#include <future>
+#include <memory>
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
 #include "tiledata.hpp"
+#include "threadpool.hpp"
+#include "fileutil.hpp"
+#include "dungeonfile.hpp"
 using namespace std;
 
+#ifdef COUNT_ALLOCATIONS
+#include <atomic>
+#include <new>
+
+// every heap allocation of the process goes through here, see CheckAllocations()
+std::atomic<unsigned long long> g_alloc_count(0);
+
+// kept out of line: inlined into a caller, malloc() and free() look mismatched with new and delete to the compiler
+#ifdef _MSC_VER
+#define ALLOC_NOINLINE __declspec(noinline)
+#else
+#define ALLOC_NOINLINE __attribute__((noinline))
+#endif
+
+ALLOC_NOINLINE void* operator new(size_t size)
+{
+	++g_alloc_count;
+	void *p = malloc(size > 0 ? size : 1);
+	if (p == NULL) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+ALLOC_NOINLINE void operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+ALLOC_NOINLINE void operator delete(void *p, std::size_t) noexcept
+{
+	free(p);
+}
+#endif
+
 const unsigned int INF = (unsigned int)-1;
 const unsigned int InvalidIndex = (unsigned int)-1;
-const unsigned int MaxTileCount = 200;
 const unsigned int MaxDoorCount = 4;		//a room may has as many doors as MaxDoorCount
 const unsigned int MaxTileWidth = 18;
 const unsigned int MaxTileHeight = 18;
-const unsigned int MaxCorridorLength = 5;
+const unsigned int MaxTileSize = MaxTileWidth > MaxTileHeight ? MaxTileWidth : MaxTileHeight;	// either side of a rotated tile
+const unsigned int MaxCorridorLength = 5;	// the longest a Graph may be set to, see Graph::SetCorridorLength
+const unsigned int DefaultExactRounds = 100;	// GenExact rounds unless the caller says otherwise
+const unsigned int SpatialCellShift = 5;	// broad-phase cell is 32x32, so a tile covers at most 2x2 cells
 
 enum GridType{
 	GridUnused = 0,
@@ -33,6 +91,17 @@ char GridChar[GridTypeCount] = {
 	'_', 'x', '.', 'd',
 };
 
+inline GridType GetGridType(char c)
+{
+	for (unsigned int t = 0; t < GridTypeCount; ++t) {
+		if (GridChar[t] == c) {
+			return (GridType)t;
+		}
+	}
+	assert(0);
+	return GridUnused;
+}
+
 enum DoorDirection{
 	DoorWrong = -1,
 	DoorUp = 0,
@@ -52,21 +121,53 @@ enum LocateMode{
 	LocateModeCount,
 };
 
+// PCG32 (XSH RR), small enough to live in every Graph, the same (seed, stream) always
+// replays the same sequence so a whole dungeon can be rebuilt from its seed
 class Random{
-	time_t m_seed;
+	unsigned long long m_state;
+	unsigned long long m_inc;	// must be odd, selects one of 2^63 independent streams
 public:
-	Random() : m_seed(time(NULL)) {}
-	unsigned int GetRand(unsigned int min, unsigned int max)
+	Random(unsigned long long seed = 0, unsigned long long stream = 0) { Seed(seed, stream); }
+	void Seed(unsigned long long seed, unsigned long long stream = 0)
+	{
+		m_state = 0;
+		m_inc = (stream << 1) | 1;
+		Next();
+		m_state += seed;
+		Next();
+	}
+	inline unsigned int Next()
+	{
+		unsigned long long old = m_state;
+		m_state = old * 6364136223846793005ULL + m_inc;
+		unsigned int xorshifted = (unsigned int)(((old >> 18) ^ old) >> 27);
+		unsigned int rot = (unsigned int)(old >> 59);
+		return (xorshifted >> rot) | (xorshifted << ((0u - rot) & 31));
+	}
+	// uniform in [min, max], Lemire's multiply-shift with rejection so there is no modulo bias
+	inline unsigned int GetRand(unsigned int min, unsigned int max)
 	{
-		time_t seed;
-		seed = time(NULL) + m_seed;
-		m_seed = seed;
-
-		srand((unsigned int)seed);
-
 		unsigned int n = max - min + 1;
-		unsigned int i = rand() % n;
-		return min + i;
+		if (n == 0) {
+			return Next();
+		}
+		unsigned long long m = (unsigned long long)Next() * n;
+		unsigned int l = (unsigned int)m;
+		if (l < n) {
+			unsigned int t = (0u - n) % n;
+			while (l < t) {
+				m = (unsigned long long)Next() * n;
+				l = (unsigned int)m;
+			}
+		}
+		return min + (unsigned int)(m >> 32);
+	}
+	// an independent generator for a sub task, e.g. one dungeon of a batch
+	Random Split()
+	{
+		unsigned long long seed = ((unsigned long long)Next() << 32) | Next();
+		unsigned long long stream = ((unsigned long long)Next() << 32) | Next();
+		return Random(seed, stream);
 	}
 };
 
@@ -116,6 +217,19 @@ struct Line{
 
 typedef std::vector<Line> LineVec;
 
+// the cells strictly between the door cells "start" and "end", false when the doors touch
+inline bool GetCorridorRect(const Vector2 &start, const Vector2 &end, Rect &rect)
+{
+	int dx = end.x - start.x, dy = end.y - start.y;
+	int len = std::abs(dx) + std::abs(dy) - 1;
+	if (len <= 0) {
+		return false;
+	}
+	rect.Set(std::min(start.x, end.x) + (dx != 0 ? 1 : 0), std::min(start.y, end.y) + (dy != 0 ? 1 : 0),
+		dx != 0 ? len : 1, dy != 0 ? len : 1);
+	return true;
+}
+
 struct Door{
 	Vector2 locate;
 	DoorDirection direction;
@@ -123,36 +237,223 @@ struct Door{
 
 typedef std::vector<Door> DoorVec;
 
+// the orientation algebra. Every table below is checked against LocateMatrices at compile time
+
+// a LocateMode as the matrix it applies to (x, y): (xx * x + xy * y, yx * x + yy * y)
+struct LocateMatrix{
+	int xx, xy, yx, yy;
+};
+
+constexpr LocateMatrix LocateMatrices[LocateModeCount] = {
+	{ 1, 0, 0, 1 },	// Rotate0
+	{ 0, 1, -1, 0 },	// Rotate90
+	{ -1, 0, 0, -1 },	// Rotate180
+	{ 0, -1, 1, 0 },	// Rotate270
+	{ 1, 0, 0, -1 },	// HoriMirror
+	{ -1, 0, 0, 1 },	// VertMirror
+};
+
+// the mode that takes a located tile back to how it was authored
+constexpr LocateMode InverseLocates[LocateModeCount] = { Rotate0, Rotate270, Rotate180, Rotate90, HoriMirror, VertMirror };
+
+// one cell out of a door, indexed by [door direction][x or y]
+constexpr int DoorSteps[DoorDirectionCount][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+
+// direction of a tile door after the tile is located, indexed by [loca_mode][door direction]
+constexpr DoorDirection LocatedDoorDirs[LocateModeCount][DoorDirectionCount] = {
+	{ DoorUp, DoorDown, DoorLeft, DoorRight },	// Rotate0
+	{ DoorRight, DoorLeft, DoorUp, DoorDown },	// Rotate90
+	{ DoorDown, DoorUp, DoorRight, DoorLeft },	// Rotate180
+	{ DoorLeft, DoorRight, DoorDown, DoorUp },	// Rotate270
+	{ DoorUp, DoorDown, DoorRight, DoorLeft },	// HoriMirror
+	{ DoorDown, DoorUp, DoorLeft, DoorRight },	// VertMirror
+};
+
+// the two ways to locate a tile so that its door faces the source door, indexed by [src direction][dst direction]
+constexpr LocateMode FacingLocates[DoorDirectionCount][DoorDirectionCount][2] = {
+	{ { Rotate180, VertMirror }, { Rotate0, HoriMirror }, { Rotate270, Rotate270 }, { Rotate90, Rotate90 } },	// DoorUp
+	{ { Rotate0, HoriMirror }, { Rotate180, VertMirror }, { Rotate90, Rotate90 }, { Rotate270, Rotate270 } },	// DoorDown
+	{ { Rotate90, Rotate90 }, { Rotate270, Rotate270 }, { Rotate180, HoriMirror }, { Rotate0, VertMirror } },	// DoorLeft
+	{ { Rotate270, Rotate270 }, { Rotate90, Rotate90 }, { Rotate0, VertMirror }, { Rotate180, HoriMirror } },	// DoorRight
+};
+
+// "first", then "then"
+constexpr LocateMatrix ComposeMatrix(const LocateMatrix &first, const LocateMatrix &then)
+{
+	return LocateMatrix{ then.xx * first.xx + then.xy * first.yx, then.xx * first.xy + then.xy * first.yy,
+		then.yx * first.xx + then.yy * first.yx, then.yx * first.xy + then.yy * first.yy };
+}
+
+constexpr bool SameMatrix(const LocateMatrix &a, const LocateMatrix &b)
+{
+	return a.xx == b.xx && a.xy == b.xy && a.yx == b.yx && a.yy == b.yy;
+}
+
+// the mode that locates like "first" followed by "then", LocateModeCount when there is none:
+// the six modes are not closed, a quarter turn after a mirror transposes the tile
+constexpr LocateMode ComposeLocates(LocateMode first, LocateMode then, unsigned int m = 0)
+{
+	return m == LocateModeCount ? LocateModeCount
+		: SameMatrix(LocateMatrices[m], ComposeMatrix(LocateMatrices[first], LocateMatrices[then])) ? (LocateMode)m
+		: ComposeLocates(first, then, m + 1);
+}
+
+// the direction of a step of one cell, DoorDirectionCount for anything else
+constexpr unsigned int StepDirection(int x, int y, unsigned int d = 0)
+{
+	return d == DoorDirectionCount ? (unsigned int)DoorDirectionCount
+		: DoorSteps[d][0] == x && DoorSteps[d][1] == y ? d
+		: StepDirection(x, y, d + 1);
+}
+
+constexpr unsigned int LocateDirection(unsigned int m, unsigned int d)
+{
+	return StepDirection(LocateMatrices[m].xx * DoorSteps[d][0] + LocateMatrices[m].xy * DoorSteps[d][1],
+		LocateMatrices[m].yx * DoorSteps[d][0] + LocateMatrices[m].yy * DoorSteps[d][1]);
+}
+
+constexpr bool CheckLocatedDoorDirs(unsigned int m = 0, unsigned int d = 0)
+{
+	return m == LocateModeCount ? true
+		: d == DoorDirectionCount ? CheckLocatedDoorDirs(m + 1, 0)
+		: (unsigned int)LocatedDoorDirs[m][d] == LocateDirection(m, d) && CheckLocatedDoorDirs(m, d + 1);
+}
+
+constexpr bool CheckInverseLocates(unsigned int m = 0)
+{
+	return m == LocateModeCount ? true
+		: ComposeLocates((LocateMode)m, InverseLocates[m]) == Rotate0 && ComposeLocates(InverseLocates[m], (LocateMode)m) == Rotate0
+			&& CheckInverseLocates(m + 1);
+}
+
+constexpr bool CheckFacingLocates(unsigned int s = 0, unsigned int d = 0)
+{
+	return s == DoorDirectionCount ? true
+		: d == DoorDirectionCount ? CheckFacingLocates(s + 1, 0)
+		: (unsigned int)LocatedDoorDirs[FacingLocates[s][d][0]][d] == StepDirection(-DoorSteps[s][0], -DoorSteps[s][1])
+			&& (unsigned int)LocatedDoorDirs[FacingLocates[s][d][1]][d] == StepDirection(-DoorSteps[s][0], -DoorSteps[s][1])
+			&& CheckFacingLocates(s, d + 1);
+}
+
+static_assert(CheckLocatedDoorDirs(), "LocatedDoorDirs must turn the doors as LocateMatrices do");
+static_assert(CheckInverseLocates(), "InverseLocates must undo LocateMatrices");
+static_assert(CheckFacingLocates(), "FacingLocates must turn the tile door to face the source door");
+static_assert(ComposeLocates(Rotate90, Rotate90) == Rotate180 && ComposeLocates(Rotate90, Rotate180) == Rotate270
+	&& ComposeLocates(HoriMirror, VertMirror) == Rotate180 && ComposeLocates(Rotate90, HoriMirror) == LocateModeCount,
+	"LocateMatrices must compose as the rotations and mirrors they stand for");
+
+inline Vector2 TransformVector(LocateMode location, const Vector2 &v)
+{
+	assert(location >= Rotate0 && location < LocateModeCount);
+	const LocateMatrix &m = LocateMatrices[location];
+	return Vector2(m.xx * v.x + m.xy * v.y, m.yx * v.x + m.yy * v.y);
+}
+
+// the "run" corridor cells after the door cell "start" in direction "dir", as GetCorridorRect gives them
+inline Rect GetStepCorridor(const Vector2 &start, unsigned int dir, int run)
+{
+	return Rect(start.x + (DoorSteps[dir][0] > 0 ? 1 : DoorSteps[dir][0] * run),
+		start.y + (DoorSteps[dir][1] > 0 ? 1 : DoorSteps[dir][1] * run),
+		DoorSteps[dir][0] != 0 ? run : 1, DoorSteps[dir][1] != 0 ? run : 1);
+}
+
+// a tile as it lies after being located in one LocateMode, baked once when the tile is loaded
+struct TileVariant{
+	unsigned int m_height, m_width;
+	Vector2 m_offset;	// topleft of the located rect relative to the pivot
+	unsigned long long m_grids[MaxTileSize];	// rows of the located rect, topleft first, the GridType of column j in bits 2j and 2j + 1
+	unsigned long long m_masks[MaxTileSize];	// bit j of row i is set when the tile covers cell (i, j)
+	Door m_doors[MaxDoorCount];	// same order in every variant, locate is relative to the pivot
+	unsigned int m_door_count;
+	unsigned int m_door_costs[MaxDoorCount][MaxDoorCount];	// steps between two doors inside the tile, INF when walled off
+	GridType GetGrid(unsigned int x, unsigned int y) const { return (GridType)((m_grids[x] >> (y * 2)) & 3); }
+};
+
+static_assert(GridTypeCount <= 4 && MaxTileSize * 2 <= 64, "a TileVariant row packs 2 bits per cell into one word");
+
+// breadth first search over the floor and door cells of a located tile from the local cell "from",
+// which may be a wall cell. dist and prev are indexed by x * MaxTileSize + y, prev leads back to "from"
+void SearchVariant(const TileVariant &variant, const Vector2 &from, unsigned int *dist, unsigned int *prev)
+{
+	static const int steps[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+	unsigned int queue[MaxTileSize * MaxTileSize];
+	std::fill(dist, dist + MaxTileSize * MaxTileSize, INF);
+	unsigned int head = 0, tail = 0;
+	unsigned int start = from.x * MaxTileSize + from.y;
+	dist[start] = 0;
+	prev[start] = start;
+	queue[tail++] = start;
+	while (head < tail) {
+		unsigned int cur = queue[head++];
+		int x = cur / MaxTileSize, y = cur % MaxTileSize;
+		for (unsigned int i = 0; i < 4; ++i) {
+			int nx = x + steps[i][0], ny = y + steps[i][1];
+			if (nx < 0 || ny < 0 || nx >= (int)variant.m_height || ny >= (int)variant.m_width) {
+				continue;
+			}
+			GridType grid = variant.GetGrid(nx, ny);
+			unsigned int next = nx * MaxTileSize + ny;
+			if ((grid == GridFloor || grid == GridDoor) && dist[next] == INF) {
+				dist[next] = dist[cur] + 1;
+				prev[next] = cur;
+				queue[tail++] = next;
+			}
+		}
+	}
+}
+
+// the variants are plain records, so a tile catalog can hand them out straight from a mapped file
 class Tile{
 	unsigned int m_type_id;
 	unsigned int m_width, m_height;
-	char m_grids[MaxTileHeight][MaxTileWidth];
-	DoorVec m_doors;
+	unsigned int m_door_count;
+	float m_weight;	// relative to the other tiles with as many doors, see TileMix
+	const TileVariant *m_variants;	// one per LocateMode, m_baked or records of a tile catalog
+	TileVariant *m_baked;	// NULL when the variants belong to someone else
+	unsigned int m_frontier_id, m_frontier_slot;	// set by TileCatalog::AddTile, see DoorFrontier
 private:
-	DoorDirection GetDoorDirection(unsigned int x, unsigned int y);
+	Tile(const Tile&);
+	Tile& operator=(const Tile&);
+	void BakeVariant(const char *grids[], const Door *doors, LocateMode loca_mode);
 public:
-	Tile(const char *grids[], unsigned int id);
+	Tile(const char *grids[], unsigned int id, float weight = 1.0f);
+	Tile(unsigned int id, unsigned int height, unsigned int width, float weight, const TileVariant *variants);
+	~Tile();
+	static DoorDirection GetDoorDirection(unsigned int height, unsigned int width, unsigned int x, unsigned int y);
+	unsigned int GetTypeId() const { return m_type_id; }
+	unsigned int GetHeight() const { return m_height; }
+	unsigned int GetWidth() const { return m_width; }
+	unsigned int GetDoorCount() const { return m_door_count; }
+	float GetWeight() const { return m_weight; }
+	const Door& GetDoor(unsigned int i) const { return m_variants[Rotate0].m_doors[i]; }	// as authored
+	const TileVariant& GetVariant(LocateMode loca_mode) const { return m_variants[loca_mode]; }
 	friend class Graph;
+	friend class TileCatalog;
+	friend void BenchPlacement();
 };
 
 typedef std::vector<Tile*> TileVec;
+typedef std::vector<const Tile*> ConstTileVec;
 
-DoorDirection Tile::GetDoorDirection(unsigned int x, unsigned int y)
+// the side a door cell of a height x width tile opens to, DoorWrong for corners and inner cells
+DoorDirection Tile::GetDoorDirection(unsigned int height, unsigned int width, unsigned int x, unsigned int y)
 {
 	DoorDirection dir = DoorWrong;
-	if(x == 0 && y > 0 && y < m_width - 1)
+	if(x == 0 && y > 0 && y < width - 1)
 		dir = DoorUp;
-	else if(x == m_height - 1 && y > 0 && y < m_width - 1)
+	else if(x == height - 1 && y > 0 && y < width - 1)
 		dir = DoorDown;
-	else if(y == 0 && x > 0 && x < m_height - 1)
+	else if(y == 0 && x > 0 && x < height - 1)
 		dir = DoorLeft;
-	else if(y == m_width - 1 && x > 0 && x < m_height - 1)
+	else if(y == width - 1 && x > 0 && x < height - 1)
 		dir = DoorRight;
 	return dir;
 }
 
-Tile::Tile(const char *grids[], unsigned int id) 
-	: m_width(0), m_height(0), m_type_id(id)
+// rows of "grids" end with an empty row
+Tile::Tile(const char *grids[], unsigned int id, float weight) 
+	: m_type_id(id), m_width(0), m_height(0), m_door_count(0), m_weight(weight), m_variants(NULL), m_baked(NULL)
+	, m_frontier_id(0), m_frontier_slot(0)
 {
 	unsigned int w = strlen(grids[0]);
 	unsigned int h = 0;
@@ -167,661 +468,5143 @@ Tile::Tile(const char *grids[], unsigned int id)
 	m_width = w;
 	m_height = h;
 
+	Door doors[MaxDoorCount];
 	for (unsigned int i = 0; i < h; ++i) {
 		for (unsigned int j = 0; j < w; ++j) {
-			m_grids[i][j] = grids[i][j];
 			if (grids[i][j] == 'd') {
-				DoorDirection dir = GetDoorDirection(i, j);
+				DoorDirection dir = GetDoorDirection(h, w, i, j);
 				if (dir != DoorWrong) {
-					Door door;
-					door.locate.Set(i, j);
-					door.direction = dir;
-					m_doors.push_back(door);
-					assert(m_doors.size() <= MaxDoorCount);
+					assert(m_door_count < MaxDoorCount);
+					doors[m_door_count].locate.Set(i, j);
+					doors[m_door_count].direction = dir;
+					++m_door_count;
 				}
 			}
 		}
 	}
+
+	// zeroed, so the unused cells and the padding of a written catalog do not depend on the heap
+	m_baked = new TileVariant[LocateModeCount];
+	memset((void*)m_baked, 0, sizeof(TileVariant) * LocateModeCount);
+	for (unsigned int i = 0; i < LocateModeCount; ++i) {
+		BakeVariant(grids, doors, (LocateMode)i);
+	}
+	m_variants = m_baked;
 }
 
-struct Arrange{
-	const Tile *m_tile;
-	Vector2 m_pivot;
-	Rect m_rect;
-	LocateMode m_locate;
-	Arrange() : m_tile(NULL), m_pivot(0, 0)
-		, m_rect(0, 0, 0, 0), m_locate(Rotate0){ }
+// a tile over variants baked earlier, they must outlive the tile
+Tile::Tile(unsigned int id, unsigned int height, unsigned int width, float weight, const TileVariant *variants)
+	: m_type_id(id), m_width(width), m_height(height), m_door_count(variants[Rotate0].m_door_count), m_weight(weight)
+	, m_variants(variants), m_baked(NULL), m_frontier_id(0), m_frontier_slot(0)
+{
+}
+
+Tile::~Tile()
+{
+	delete[] m_baked;
+}
+
+void Tile::BakeVariant(const char *grids[], const Door *doors, LocateMode loca_mode)
+{
+	TileVariant &variant = m_baked[loca_mode];
+	Vector2 corner = TransformVector(loca_mode, Vector2(m_height - 1, m_width - 1));
+	variant.m_offset.Set(std::min(corner.x, 0), std::min(corner.y, 0));
+	variant.m_height = std::abs(corner.x) + 1;
+	variant.m_width = std::abs(corner.y) + 1;
+
+	memset(variant.m_grids, 0, sizeof(variant.m_grids));
+	memset(variant.m_masks, 0, sizeof(variant.m_masks));
+	for (unsigned int i = 0; i < m_height; ++i) {
+		for (unsigned int j = 0; j < m_width; ++j) {
+			Vector2 cell = TransformVector(loca_mode, Vector2(i, j)) - variant.m_offset;
+			variant.m_grids[cell.x] |= (unsigned long long)GetGridType(grids[i][j]) << (cell.y * 2);
+			if (grids[i][j] != GridChar[GridUnused]) {
+				variant.m_masks[cell.x] |= 1ULL << cell.y;
+			}
+		}
+	}
+
+	variant.m_door_count = m_door_count;
+	for (unsigned int i = 0; i < m_door_count; ++i) {
+		variant.m_doors[i].locate = TransformVector(loca_mode, doors[i].locate);
+		variant.m_doors[i].direction = LocatedDoorDirs[loca_mode][doors[i].direction];
+	}
+
+	unsigned int dist[MaxTileSize * MaxTileSize], prev[MaxTileSize * MaxTileSize];
+	for (unsigned int i = 0; i < variant.m_door_count; ++i) {
+		SearchVariant(variant, variant.m_doors[i].locate - variant.m_offset, dist, prev);
+		for (unsigned int j = 0; j < variant.m_door_count; ++j) {
+			Vector2 cell = variant.m_doors[j].locate - variant.m_offset;
+			variant.m_door_costs[i][j] = dist[cell.x * MaxTileSize + cell.y];
+		}
+	}
+}
+
+// tile definition files hold any number of tiles, each one a "tile <type id> [weight]" line followed
+// by its rows, and ended by an empty line or the end of the file. The weight is positive and 1 when
+// left out. Lines starting with '#' are skipped:
+//
+//   # a dead end
+//   tile 10
+//   xxxxx
+//   x...d
+//   xxxxx
+//
+// appends the tiles to "tiles", false and a message on cerr when the file has an error
+bool ParseTileFile(const std::string &path, TileVec &tiles)
+{
+	std::ifstream in(path.c_str());
+	if (!in) {
+		cerr<<path<<": cannot open"<<endl;
+		return false;
+	}
+	std::vector<std::string> rows;
+	std::string line;
+	unsigned int line_no = 0, tile_line = 0, id = 0;
+	float weight = 1.0f;
+	bool in_tile = false, ok = true;
+	// runs once more at the end of the file with an empty line
+	for (bool more = true; more && ok; ) {
+		more = (bool)std::getline(in, line);
+		++line_no;
+		if (!line.empty() && line[line.size() - 1] == '\r') {
+			line.erase(line.size() - 1);
+		}
+		if (more && !line.empty() && line[0] == '#') {
+			continue;
+		}
+		if (!in_tile) {
+			if (line.empty()) {
+				continue;
+			}
+			weight = 1.0f;
+			ok = sscanf(line.c_str(), "tile %u %f", &id, &weight) >= 1 && weight > 0.0f;
+			in_tile = true;
+			tile_line = line_no;
+			rows.clear();
+			continue;
+		}
+		if (!line.empty()) {
+			ok = line.find_first_not_of("_x.d") == std::string::npos && (rows.empty() || line.size() == rows[0].size());
+			rows.push_back(line);
+			continue;
+		}
+
+		// a whole tile, check what the Tile constructor asserts
+		in_tile = false;
+		unsigned int h = rows.size(), w = h > 0 ? rows[0].size() : 0, doors = 0;
+		for (unsigned int i = 0; i < h; ++i) {
+			for (unsigned int j = 0; j < w; ++j) {
+				doors += (rows[i][j] == 'd' && Tile::GetDoorDirection(h, w, i, j) != DoorWrong) ? 1 : 0;
+			}
+		}
+		if (h > MaxTileHeight || w > MaxTileWidth) {
+			// a variant row is one word and a placement must fit an OccupancyWindow, so the limit is a build constant
+			cerr<<path<<":"<<tile_line<<": tile "<<id<<" is "<<h<<"x"<<w<<", larger than the "<<MaxTileHeight<<"x"<<MaxTileWidth
+				<<" this build supports (MaxTileHeight x MaxTileWidth)"<<endl;
+			return false;
+		}
+		if (h < 3 || w < 3 || doors == 0 || doors > MaxDoorCount) {
+			cerr<<path<<":"<<tile_line<<": tile "<<id<<" must be at least 3x3 with 1 to "<<MaxDoorCount<<" doors on its sides"<<endl;
+			return false;
+		}
+		std::vector<const char*> grids(h + 1);
+		for (unsigned int i = 0; i < h; ++i) {
+			grids[i] = rows[i].c_str();
+		}
+		grids[h] = "";
+		tiles.push_back(new Tile(grids.data(), id, weight));
+	}
+	if (!ok) {
+		cerr<<path<<":"<<line_no<<": expected \"tile <id> [weight > 0]\" or a row of _x.d as wide as the first"<<endl;
+	}
+	return ok;
+}
+
+// a compiled tile library, little-endian and read in place from a mapping like a dungeon file:
+//   TileCatalogHeader
+//   TileCatalogEntry[tile_count]	ordered by door count
+//   TileVariant[tile_count * LocateModeCount]
+//   unsigned int buckets[MaxDoorCount + 1]	tiles with k + 1 doors are entries [buckets[k], buckets[k + 1])
+const char TileCatalogMagic[4] = { 'R', 'L', 'T', 'C' };
+const unsigned int TileCatalogVersion = 3;
+
+struct TileCatalogHeader{
+	char magic[4];
+	unsigned int version;
+	unsigned int tile_count;
+	unsigned int variant_size;	// sizeof(TileVariant), with the two limits below a build with other limits rejects the file
+	unsigned int max_tile_size, max_door_count;
+	unsigned long long source_stamp;	// names, sizes and times of the definition files
+	unsigned long long payload_size;	// bytes after the header
+	unsigned long long payload_checksum;
+	unsigned long long header_checksum;	// over the bytes above
 };
 
-typedef std::vector<Arrange*> ArrangeVec;
-typedef std::vector<unsigned int> IndexVec;
+struct TileCatalogEntry{
+	unsigned int type_id;
+	unsigned int height, width;	// as authored
+	float weight;
+};
 
-class Graph{
-	ArrangeVec m_arranges;
-	IndexVec m_adj_list[MaxTileCount];
+static_assert(sizeof(TileCatalogHeader) == 56, "TileCatalogHeader must not have padding");
+static_assert(sizeof(TileCatalogEntry) == 16, "TileCatalogEntry must not have padding");
+static_assert(sizeof(TileVariant) % 8 == 0, "TileVariant records must keep the sections aligned");
+
+class TileCatalog;
+typedef std::shared_ptr<const TileCatalog> TileCatalogPtr;
+
+// an immutable tile library: the tiles bucketed by door count, with their oriented variants and door
+// costs baked and their DoorFrontier ids handed out once. Any number of Graphs on any threads generate
+// from one catalog, it goes away with the last of them
+class TileCatalog{
 	TileVec m_src_tiles[MaxDoorCount];
-	DoorVec m_open_doors;
-	LineVec m_lines;
-	Random m_random;
 	unsigned int m_max_door;
-	unsigned int m_cur_tile_count;
+	unsigned int m_tile_count;
+	unsigned int m_slot_count;	// doors of all the tiles, see DoorFrontier
+	MappedFile m_file;	// the catalog file the variants point into, see Load
 private:
+	TileCatalog() : m_max_door(0), m_tile_count(0), m_slot_count(0) { }
+	TileCatalog(const TileCatalog&);
+	TileCatalog& operator=(const TileCatalog&);
 	void AddTile(Tile *tile);
-	unsigned int FindArrange(const Vector2 &coord);
-	Rect GetTileRect(const Tile *tile, const Vector2 &coord, LocateMode loca_mode) const;
-	bool CheckTile(const Tile *tile, const Vector2 &coord, LocateMode loca_mode) const;
-	void LinkTile(unsigned int arr_idx, const Tile *tile, const Vector2 &coord, LocateMode loca_mode);
-	void AddDoors(const Tile *tile, const Vector2 &coord, LocateMode loca_mode, unsigned int exclude_door_idx = InvalidIndex);
-	void DelDoor(unsigned int idx);
-	void AddLink(const Vector2 &start, const Vector2 &end);
-	Tile* ChooseEndTile();
-	Tile* ChooseLinkTile();
-	void GenNewLocate(const Door *src_door, const Door *dst_door, Vector2 &door_pos, Vector2 &coord, LocateMode &loca_mode);
-	Vector2 TransformVector(LocateMode location, const Vector2 &v) const;
+	bool IsComplete() const;
+	bool Map(const char *path, unsigned long long stamp);
+	bool Save(const char *path, unsigned long long stamp) const;
 public:
-	Graph();
-	~Graph();
-	void Reset();
-	bool RandomGen(unsigned int tile_count);
-	bool GenExact(unsigned int tile_count, unsigned int max_try = 100); // we try as many as "max_try" times to get a result with exactly has "tile_count" tiles
-	void FindPath(unsigned int start_idx, unsigned int end_idx, IndexVec &path);
-	void Print();
+	~TileCatalog();
+	static TileCatalogPtr GetBuiltin();
+	static TileCatalogPtr Load(const char *dir, const char *cache_path = NULL);
+	unsigned int GetMaxDoor() const { return m_max_door; }
+	unsigned int GetTileCount() const { return m_tile_count; }
+	unsigned int GetSlotCount() const { return m_slot_count; }
+	const TileVec& GetBucket(unsigned int i) const { return m_src_tiles[i]; }	// the tiles with i + 1 doors
+	const Tile* FindTile(unsigned int type_id) const;
 };
 
-Graph::Graph() : m_max_door(0), m_cur_tile_count(0)
+TileCatalog::~TileCatalog()
 {
-	Tile *tile = new Tile(tile1_0, 10);
-	AddTile(tile);
-	tile = new Tile(tile2_0, 20);
-	AddTile(tile);
-	tile = new Tile(tile2_1, 21);
-	AddTile(tile);
-	tile = new Tile(tile3_0, 30);
-	AddTile(tile);
-	tile = new Tile(tile3_1, 31);
-	AddTile(tile);
-
-	// check valid
-	assert(m_max_door >= 2);
-	for (unsigned int i = 0; i < m_max_door; ++i) {
-		assert(m_src_tiles[i].size() > 0);
+	for (unsigned int i = 0; i < MaxDoorCount; ++i) {
+		for (unsigned int k = 0; k < m_src_tiles[i].size(); ++k) {
+			delete m_src_tiles[i][k];
+		}
 	}
 }
 
-Graph::~Graph()
+// the tiles of tiledata.hpp, baked on the first call
+TileCatalogPtr TileCatalog::GetBuiltin()
 {
-	for (unsigned int i = 0; i < MaxDoorCount; ++i) {
-		TileVec::iterator itr = m_src_tiles[i].begin();
-		for (; itr != m_src_tiles[i].end(); ++itr) {
-			delete (*itr);
-		}
-		m_src_tiles[i].clear();
-	}
-	
-	ArrangeVec::iterator itr = m_arranges.begin();
-	for (; itr != m_arranges.end(); ++itr) {
-		delete (*itr);
-	}
-	m_arranges.clear();
-	m_open_doors.clear();
+	static const TileCatalogPtr builtin([]() {
+		TileCatalog *catalog = new TileCatalog;
+		catalog->AddTile(new Tile(tile1_0, 10));
+		catalog->AddTile(new Tile(tile2_0, 20));
+		catalog->AddTile(new Tile(tile2_1, 21));
+		catalog->AddTile(new Tile(tile3_0, 30));
+		catalog->AddTile(new Tile(tile3_1, 31));
+		assert(catalog->IsComplete());
+		return catalog;
+	}());
+	return builtin;
 }
 
-void Graph::AddTile(Tile *tile)
+void TileCatalog::AddTile(Tile *tile)
 {
-	unsigned int door_count = tile->m_doors.size();
+	unsigned int door_count = tile->m_door_count;
 	assert(door_count > 0 && door_count <= MaxDoorCount);
 	m_src_tiles[door_count - 1].push_back(tile);
+	tile->m_frontier_id = m_tile_count++;
+	tile->m_frontier_slot = m_slot_count;
+	m_slot_count += door_count;
 	if (door_count > m_max_door) {
 		m_max_door = door_count;
 	}
 }
 
-void Graph::Reset()
+// ChooseLinkTile and ChooseEndTile need a tile with at least 2 doors and every bucket up to the largest door count
+bool TileCatalog::IsComplete() const
 {
-	 m_cur_tile_count = 0;
-	 ArrangeVec::iterator itr = m_arranges.begin();
-	 for (; itr != m_arranges.end(); ++itr) {
-		 delete (*itr);
-	 }
-	 m_arranges.clear();
-	 m_open_doors.clear();
-	 m_lines.clear();
-	 
-	 for (unsigned int i = 0; i < MaxTileCount; ++i) {
-		m_adj_list[i].clear();
-	 }
+	bool ok = m_max_door >= 2;
+	for (unsigned int i = 0; i < m_max_door && ok; ++i) {
+		ok = !m_src_tiles[i].empty();
+	}
+	return ok;
 }
 
-unsigned int Graph::FindArrange(const Vector2 &coord)
+const Tile* TileCatalog::FindTile(unsigned int type_id) const
 {
-	for (unsigned int i = 0; i < m_arranges.size(); ++i) {
-		if (m_arranges[i]->m_rect.Contain(coord)) {
-			return i;
+	for (unsigned int i = 0; i < m_max_door; ++i) {
+		for (unsigned int k = 0; k < m_src_tiles[i].size(); ++k) {
+			if (m_src_tiles[i][k]->m_type_id == type_id) {
+				return m_src_tiles[i][k];
+			}
 		}
 	}
-	return -1;
+	return NULL;
 }
 
-Rect Graph::GetTileRect(const Tile *tile, const Vector2 &coord, LocateMode loca_mode) const
+// the tiles of the "*.tile" definitions in "dir", see ParseTileFile. With a cache_path the baked tiles
+// are kept there as a tile catalog file, and a later Load maps that file instead of parsing and baking
+// again as long as no definition file was added, removed or touched. NULL and a message on cerr on errors
+TileCatalogPtr TileCatalog::Load(const char *dir, const char *cache_path)
 {
-	unsigned int h = 0, w = 0;
-	unsigned int x = 0, y = 0;
-	switch(loca_mode)
-	{
-	case Rotate0:
-		x = coord.x;
-		y = coord.y;
-		h = tile->m_height;
-		w = tile->m_width;
-		break;
-	case Rotate90:
-		x = coord.x;
-		y = coord.y - (tile->m_height - 1);
-		h = tile->m_width;
-		w = tile->m_height;
-		break;
-	case Rotate180:
-		x = coord.x - (tile->m_height - 1);
-		y = coord.y - (tile->m_width - 1);
-		h = tile->m_height;
-		w = tile->m_width;
-		break;
-	case Rotate270:
-		x = coord.x - (tile->m_width - 1);
-		y = coord.y;
-		h = tile->m_width;
-		w = tile->m_height;
-		break;
-	case HoriMirror:
-		x = coord.x;
-		y = coord.y - (tile->m_width - 1);
-		h = tile->m_height;
-		w = tile->m_width;
-		break;
-	case VertMirror:
-		x = coord.x - (tile->m_height - 1);
-		y = coord.y;
-		h = tile->m_height;
-		w = tile->m_width;
-		break;
-	default:
-		break;
+	FileInfoVec files;
+	if (!ListFiles(dir, ".tile", files)) {
+		cerr<<dir<<": cannot list the tile definitions"<<endl;
+		return TileCatalogPtr();
+	}
+	unsigned long long stamp = 14695981039346656037ULL;
+	for (unsigned int i = 0; i < files.size(); ++i) {
+		unsigned long long values[] = { FileChecksum(files[i].name.data(), files[i].name.size()), files[i].size, files[i].mtime };
+		stamp = (stamp ^ FileChecksum(values, sizeof(values))) * 1099511628211ULL;
+	}
+
+	std::shared_ptr<TileCatalog> catalog(new TileCatalog);
+	if (cache_path != NULL && catalog->Map(cache_path, stamp)) {
+		return catalog;
 	}
 
-	return Rect(x, y, h, w);
+	TileVec tiles;
+	bool ok = true;
+	for (unsigned int i = 0; i < files.size() && ok; ++i) {
+		ok = ParseTileFile(std::string(dir) + "/" + files[i].name, tiles);
+	}
+	// the catalog owns the tiles from here on, also the ones of a file that failed
+	for (unsigned int i = 0; i < tiles.size(); ++i) {
+		catalog->AddTile(tiles[i]);
+	}
+	if (!ok) {
+		return TileCatalogPtr();
+	}
+	if (!catalog->IsComplete()) {
+		cerr<<dir<<": the tiles need at least 2 doors on one tile, and a tile for every door count up to the largest"<<endl;
+		return TileCatalogPtr();
+	}
+	if (cache_path != NULL && !catalog->Save(cache_path, stamp)) {
+		cerr<<cache_path<<": cannot write the tile catalog"<<endl;
+	}
+	return catalog;
 }
 
-bool Graph::CheckTile(const Tile *tile, const Vector2 &coord, LocateMode loca_mode) const
+// false when the catalog file is missing, corrupt, stale or written by a build with other limits
+bool TileCatalog::Map(const char *path, unsigned long long stamp)
 {
-	Rect rect = GetTileRect(tile, coord, loca_mode);
-	for (unsigned int i = 0; i < m_arranges.size(); ++i) {
-		if (rect.Intersect(m_arranges[i]->m_rect)) {
-			return false;
+	MappedFile file;
+	if (!IsLittleEndian() || !file.Open(path) || file.GetSize() < sizeof(TileCatalogHeader)) {
+		return false;
+	}
+	const TileCatalogHeader *header = (const TileCatalogHeader*)file.GetData();
+	if (memcmp(header->magic, TileCatalogMagic, sizeof(TileCatalogMagic)) != 0 || header->version != TileCatalogVersion
+		|| header->variant_size != sizeof(TileVariant) || header->max_tile_size != MaxTileSize
+		|| header->max_door_count != MaxDoorCount || header->source_stamp != stamp
+		|| FileChecksum(header, offsetof(TileCatalogHeader, header_checksum)) != header->header_checksum) {
+		return false;
+	}
+	size_t entries_size = AlignFileSection((size_t)header->tile_count * sizeof(TileCatalogEntry));
+	size_t variants_size = (size_t)header->tile_count * LocateModeCount * sizeof(TileVariant);
+	size_t buckets_size = AlignFileSection((MaxDoorCount + 1) * sizeof(unsigned int));
+	const unsigned char *payload = file.GetData() + sizeof(TileCatalogHeader);
+	if (header->payload_size != entries_size + variants_size + buckets_size
+		|| header->payload_size != file.GetSize() - sizeof(TileCatalogHeader)
+		|| FileChecksum(payload, (size_t)header->payload_size) != header->payload_checksum) {
+		return false;
+	}
+	const TileCatalogEntry *entries = (const TileCatalogEntry*)payload;
+	const TileVariant *variants = (const TileVariant*)(payload + entries_size);
+	const unsigned int *buckets = (const unsigned int*)(payload + entries_size + variants_size);
+
+	m_file.Swap(file);
+	for (unsigned int b = 0; b < MaxDoorCount; ++b) {
+		for (unsigned int i = buckets[b]; i < buckets[b + 1]; ++i) {
+			AddTile(new Tile(entries[i].type_id, entries[i].height, entries[i].width, entries[i].weight, variants + i * LocateModeCount));
 		}
 	}
-	
 	return true;
 }
 
-// the origin of a Tile locate at the CENTER point of topleft
-void Graph::LinkTile(unsigned int arr_idx, const Tile *tile, const Vector2 &coord, LocateMode loca_mode)
+bool TileCatalog::Save(const char *path, unsigned long long stamp) const
 {
-	++m_cur_tile_count;
-	Arrange *arrange = new Arrange;
-	arrange->m_pivot = coord;
-	arrange->m_rect = GetTileRect(tile, coord, loca_mode);
-	arrange->m_tile = tile;
-	arrange->m_locate = loca_mode;
-	m_arranges.push_back(arrange);
+	if (!IsLittleEndian()) {
+		return false;
+	}
+	const unsigned int tile_count = m_tile_count;
+	size_t entries_size = AlignFileSection(tile_count * sizeof(TileCatalogEntry));
+	size_t variants_size = tile_count * LocateModeCount * sizeof(TileVariant);
+	size_t buckets_size = AlignFileSection((MaxDoorCount + 1) * sizeof(unsigned int));
+	std::vector<unsigned char> buffer(sizeof(TileCatalogHeader) + entries_size + variants_size + buckets_size, 0);
+	unsigned char *payload = buffer.data() + sizeof(TileCatalogHeader);
 
-	if (arr_idx != InvalidIndex) {
-		// add to adjacency list
-		unsigned int new_vertex = m_arranges.size() - 1;
-		m_adj_list[arr_idx].push_back(new_vertex);
-		m_adj_list[new_vertex].push_back(arr_idx);
+	TileCatalogEntry *entries = (TileCatalogEntry*)payload;
+	TileVariant *variants = (TileVariant*)(payload + entries_size);
+	unsigned int *buckets = (unsigned int*)(payload + entries_size + variants_size);
+	unsigned int index = 0;
+	for (unsigned int b = 0; b < MaxDoorCount; ++b) {
+		buckets[b] = index;
+		for (unsigned int k = 0; k < m_src_tiles[b].size(); ++k, ++index) {
+			const Tile *tile = m_src_tiles[b][k];
+			entries[index].type_id = tile->m_type_id;
+			entries[index].height = tile->m_height;
+			entries[index].width = tile->m_width;
+			entries[index].weight = tile->m_weight;
+			memcpy((void*)(variants + index * LocateModeCount), tile->m_variants, LocateModeCount * sizeof(TileVariant));
+		}
+	}
+	buckets[MaxDoorCount] = index;
+
+	TileCatalogHeader *header = (TileCatalogHeader*)buffer.data();
+	memcpy(header->magic, TileCatalogMagic, sizeof(TileCatalogMagic));
+	header->version = TileCatalogVersion;
+	header->tile_count = tile_count;
+	header->variant_size = sizeof(TileVariant);
+	header->max_tile_size = MaxTileSize;
+	header->max_door_count = MaxDoorCount;
+	header->source_stamp = stamp;
+	header->payload_size = buffer.size() - sizeof(TileCatalogHeader);
+	header->payload_checksum = FileChecksum(payload, (size_t)header->payload_size);
+	header->header_checksum = FileChecksum(header, offsetof(TileCatalogHeader, header_checksum));
+
+	FILE *file = fopen(path, "wb");
+	if (file == NULL) {
+		return false;
 	}
+	bool ok = fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+	return fclose(file) == 0 && ok;
 }
 
-void Graph::AddDoors(const Tile *tile, const Vector2 &coord, LocateMode loca_mode, unsigned int exclude_door_idx)
+struct Arrange{
+	const Tile *m_tile;
+	Vector2 m_pivot;
+	Rect m_rect;
+	LocateMode m_locate;
+	Arrange() : m_tile(NULL), m_pivot(0, 0)
+		, m_rect(0, 0, 0, 0), m_locate(Rotate0){ }
+};
+
+typedef std::vector<unsigned int> IndexVec;
+
+// Vose's alias method, after Build a draw takes index i with probability weights[i] / sum in O(1):
+// one uniform column, then a coin that keeps the column or moves to its alias
+class AliasTable{
+	std::vector<unsigned long long> m_thresholds;	// keep column i when a 32 bit draw is below, 1 << 32 always keeps it
+	IndexVec m_alias;
+public:
+	inline unsigned int Size() const { return m_alias.size(); }
+	void Build(const std::vector<double> &weights);	// weights >= 0 with a positive sum
+	inline unsigned int Sample(Random &random) const {
+		unsigned int i = random.GetRand(0, m_alias.size() - 1);
+		return random.Next() < m_thresholds[i] ? i : m_alias[i];
+	}
+	void Clear() { m_thresholds.clear(); m_alias.clear(); }
+};
+
+void AliasTable::Build(const std::vector<double> &weights)
 {
-	static DoorDirection door_dirs[LocateModeCount][DoorDirectionCount];
-	door_dirs[Rotate0][DoorDown] = DoorDown;
-	door_dirs[Rotate0][DoorUp] = DoorUp;
-	door_dirs[Rotate0][DoorLeft] = DoorLeft;
-	door_dirs[Rotate0][DoorRight] = DoorRight;
-	door_dirs[Rotate90][DoorDown] = DoorLeft;
-	door_dirs[Rotate90][DoorUp] = DoorRight;
-	door_dirs[Rotate90][DoorLeft] = DoorUp;
-	door_dirs[Rotate90][DoorRight] = DoorDown;
-	door_dirs[Rotate180][DoorDown] = DoorUp;
-	door_dirs[Rotate180][DoorUp] = DoorDown;
-	door_dirs[Rotate180][DoorLeft] = DoorRight;
-	door_dirs[Rotate180][DoorRight] = DoorLeft;
-	door_dirs[Rotate270][DoorDown] = DoorRight;
-	door_dirs[Rotate270][DoorUp] = DoorLeft;
-	door_dirs[Rotate270][DoorLeft] = DoorDown;
-	door_dirs[Rotate270][DoorRight] = DoorUp;
-	door_dirs[HoriMirror][DoorDown] = DoorDown;
-	door_dirs[HoriMirror][DoorUp] = DoorUp;
-	door_dirs[HoriMirror][DoorLeft] = DoorRight;
-	door_dirs[HoriMirror][DoorRight] = DoorLeft;
-	door_dirs[VertMirror][DoorDown] = DoorUp;
-	door_dirs[VertMirror][DoorUp] = DoorDown;
-	door_dirs[VertMirror][DoorLeft] = DoorLeft;
-	door_dirs[VertMirror][DoorRight] = DoorRight;
-	for (unsigned int i = 0; i < tile->m_doors.size(); ++i) {
-		if (i == exclude_door_idx) {
-			continue;
+	const unsigned int n = weights.size();
+	double sum = 0.0;
+	for (unsigned int i = 0; i < n; ++i) {
+		sum += weights[i];
+	}
+	assert(n > 0 && sum > 0.0);
+	m_thresholds.resize(n);
+	m_alias.resize(n);
+
+	// columns below the mean take their missing part from one above the mean
+	std::vector<double> scaled(n);
+	IndexVec small, large;
+	for (unsigned int i = 0; i < n; ++i) {
+		scaled[i] = weights[i] * n / sum;
+		(scaled[i] < 1.0 ? small : large).push_back(i);
+	}
+	while (!small.empty() && !large.empty()) {
+		unsigned int s = small.back(), l = large.back();
+		small.pop_back();
+		m_thresholds[s] = (unsigned long long)(scaled[s] * 4294967296.0);
+		m_alias[s] = l;
+		scaled[l] -= 1.0 - scaled[s];
+		if (scaled[l] < 1.0) {
+			large.pop_back();
+			small.push_back(l);
 		}
-		Door door;
-		door.direction = door_dirs[loca_mode][tile->m_doors[i].direction];
-		door.locate = coord + TransformVector(loca_mode, tile->m_doors[i].locate);
-		m_open_doors.push_back(door);
+	}
+	// whatever is left is full up to rounding
+	for (unsigned int i = 0; i < small.size(); ++i) {
+		m_thresholds[small[i]] = 1ULL << 32;
+		m_alias[small[i]] = small[i];
+	}
+	for (unsigned int i = 0; i < large.size(); ++i) {
+		m_thresholds[large[i]] = 1ULL << 32;
+		m_alias[large[i]] = large[i];
 	}
 }
 
-void Graph::DelDoor(unsigned int idx)
-{
-	if (idx != -1) {
-		m_open_doors[idx] = *m_open_doors.rbegin();
-		m_open_doors.pop_back();
+// the placed tiles as a structure of arrays, so the overlap scans only walk the rect fields.
+// All the arrays live in one arena block: a room is pushed at the top, and Rewind(mark) drops
+// every room pushed after GetMark() returned "mark" without touching the heap. The block only
+// grows, once warmed up placing and resetting never allocates
+class ArrangeStore{
+	unsigned char *m_block;
+	unsigned int m_size, m_capacity;
+	const Tile **m_tiles;
+	int *m_x, *m_y, *m_h, *m_w;	// Arrange::m_rect
+	int *m_pivot_x, *m_pivot_y;
+	unsigned char *m_locates;
+private:
+	ArrangeStore(const ArrangeStore&);
+	ArrangeStore& operator=(const ArrangeStore&);
+	static size_t GetRowSize() { return sizeof(const Tile*) + sizeof(int) * 6 + sizeof(unsigned char); }
+	void Grow(unsigned int capacity);
+public:
+	ArrangeStore() : m_block(NULL), m_size(0), m_capacity(0), m_tiles(NULL), m_x(NULL), m_y(NULL), m_h(NULL), m_w(NULL)
+		, m_pivot_x(NULL), m_pivot_y(NULL), m_locates(NULL) { }
+	~ArrangeStore() { delete[] m_block; }
+	inline unsigned int Size() const { return m_size; }
+	inline Rect GetRect(unsigned int i) const { return Rect(m_x[i], m_y[i], m_h[i], m_w[i]); }
+	inline bool Intersect(unsigned int i, const Rect &rect) const {
+		return !(m_x[i] + m_h[i] - 1 < rect.x || m_y[i] + m_w[i] - 1 < rect.y
+			|| rect.x + rect.h - 1 < m_x[i] || rect.y + rect.w - 1 < m_y[i]);
 	}
+	inline bool Contain(unsigned int i, const Vector2 &p) const {
+		return p.x >= m_x[i] && p.x <= m_x[i] + m_h[i] && p.y >= m_y[i] && p.y <= m_y[i] + m_w[i];
+	}
+	inline const Tile* GetTile(unsigned int i) const { return m_tiles[i]; }
+	inline LocateMode GetLocate(unsigned int i) const { return (LocateMode)m_locates[i]; }
+	Arrange operator[](unsigned int i) const;
+	void Push(const Arrange &arrange);
+	unsigned int GetMark() const { return m_size; }
+	void Rewind(unsigned int mark) { assert(mark <= m_size); m_size = mark; }
+	void Reserve(unsigned int count) { if (count > m_capacity) Grow(count); }
+	void Clear() { Rewind(0); }
+	size_t GetMemoryUsage() const { return m_capacity * GetRowSize(); }
+};
+
+Arrange ArrangeStore::operator[](unsigned int i) const
+{
+	Arrange arrange;
+	arrange.m_tile = m_tiles[i];
+	arrange.m_pivot.Set(m_pivot_x[i], m_pivot_y[i]);
+	arrange.m_rect = GetRect(i);
+	arrange.m_locate = (LocateMode)m_locates[i];
+	return arrange;
 }
 
-void Graph::AddLink(const Vector2 &start, const Vector2 &end)
+void ArrangeStore::Push(const Arrange &arrange)
 {
-	Line line;
-	line.start = start;
-	line.end = end;
-	m_lines.push_back(line);
+	if (m_size == m_capacity) {
+		Grow(std::max(m_capacity * 2, 16u));
+	}
+	const unsigned int i = m_size++;
+	m_tiles[i] = arrange.m_tile;
+	m_x[i] = arrange.m_rect.x;
+	m_y[i] = arrange.m_rect.y;
+	m_h[i] = arrange.m_rect.h;
+	m_w[i] = arrange.m_rect.w;
+	m_pivot_x[i] = arrange.m_pivot.x;
+	m_pivot_y[i] = arrange.m_pivot.y;
+	m_locates[i] = (unsigned char)arrange.m_locate;
 }
 
-Tile* Graph::ChooseEndTile()
-{
-	unsigned int tile_cnt = m_src_tiles[0].size();
-	unsigned int tile_idx = m_random.GetRand(0, tile_cnt - 1);
-	return m_src_tiles[0][tile_idx];
-}
-
-Tile* Graph::ChooseLinkTile()
-{
-	unsigned int index = m_random.GetRand(1, m_max_door - 1);
-	unsigned int tile_cnt = m_src_tiles[index].size();
-	unsigned int tile_idx = m_random.GetRand(0, tile_cnt - 1);
-	return m_src_tiles[index][tile_idx];
-}
-
-void Graph::GenNewLocate(const Door *src_door, const Door *dst_door, Vector2 &door_pos, Vector2 &coord, LocateMode &loca_mode)
-{
-	static LocateMode localModes[DoorDirectionCount][DoorDirectionCount][2];
-	localModes[DoorDown][DoorDown][0] = Rotate180;
-	localModes[DoorDown][DoorDown][1] = VertMirror;
-	localModes[DoorDown][DoorUp][0] = Rotate0;
-	localModes[DoorDown][DoorUp][1] = HoriMirror;
-	localModes[DoorDown][DoorLeft][0] = Rotate90;
-	localModes[DoorDown][DoorLeft][1] = Rotate90;
-	localModes[DoorDown][DoorRight][0] = Rotate270;
-	localModes[DoorDown][DoorRight][1] = Rotate270;
-
-	localModes[DoorUp][DoorDown][0] = Rotate0;
-	localModes[DoorUp][DoorDown][1] = HoriMirror;
-	localModes[DoorUp][DoorUp][0] = Rotate180;
-	localModes[DoorUp][DoorUp][1] = VertMirror;
-	localModes[DoorUp][DoorLeft][0] = Rotate270;
-	localModes[DoorUp][DoorLeft][1] = Rotate270;
-	localModes[DoorUp][DoorRight][0] = Rotate90;
-	localModes[DoorUp][DoorRight][1] = Rotate90;
-
-	localModes[DoorLeft][DoorDown][0] = Rotate270;
-	localModes[DoorLeft][DoorDown][1] = Rotate270;
-	localModes[DoorLeft][DoorUp][0] = Rotate90;
-	localModes[DoorLeft][DoorUp][1] = Rotate90;
-	localModes[DoorLeft][DoorLeft][0] = Rotate180;
-	localModes[DoorLeft][DoorLeft][1] = HoriMirror;
-	localModes[DoorLeft][DoorRight][0] = Rotate0;
-	localModes[DoorLeft][DoorRight][1] = VertMirror;
-
-	localModes[DoorRight][DoorDown][0] = Rotate90;
-	localModes[DoorRight][DoorDown][1] = Rotate90;
-	localModes[DoorRight][DoorUp][0] = Rotate270;
-	localModes[DoorRight][DoorUp][1] = Rotate270;
-	localModes[DoorRight][DoorLeft][0] = Rotate0;
-	localModes[DoorRight][DoorLeft][1] = VertMirror;
-	localModes[DoorRight][DoorRight][0] = Rotate180;
-	localModes[DoorRight][DoorRight][1] = HoriMirror;
-
-	int len = m_random.GetRand(1, MaxCorridorLength);
-	Vector2 extends[DoorDirectionCount];
-	extends[DoorDown].Set(1, 0);
-	extends[DoorUp].Set(-1, 0);
-	extends[DoorLeft].Set(0, -1);
-	extends[DoorRight].Set(0, 1);
-	door_pos = src_door->locate + extends[src_door->direction] * len;
-
-	coord.Set(0, 0);
-	loca_mode = localModes[src_door->direction][dst_door->direction][m_random.GetRand(0, 1)];
-	coord = door_pos - TransformVector(loca_mode, dst_door->locate);
-}
-
-Vector2 Graph::TransformVector(LocateMode location, const Vector2 &v) const
-{
-	Vector2 vec(0, 0);
-	switch(location)
+// moves the arrays to a block of "capacity" rows, pointers first so that every array stays aligned
+void ArrangeStore::Grow(unsigned int capacity)
+{
+	unsigned char *block = new unsigned char[capacity * GetRowSize()];
+	const Tile **tiles = (const Tile**)block;
+	int *ints = (int*)(block + capacity * sizeof(const Tile*));
+	unsigned char *locates = (unsigned char*)(ints + capacity * 6);
+	if (m_size > 0) {
+		memcpy(tiles, m_tiles, m_size * sizeof(const Tile*));
+		int *columns[6] = { m_x, m_y, m_h, m_w, m_pivot_x, m_pivot_y };
+		for (unsigned int k = 0; k < 6; ++k) {
+			memcpy(ints + k * capacity, columns[k], m_size * sizeof(int));
+		}
+		memcpy(locates, m_locates, m_size);
+	}
+	delete[] m_block;
+	m_block = block;
+	m_capacity = capacity;
+	m_tiles = tiles;
+	m_x = ints;
+	m_y = ints + capacity;
+	m_h = ints + capacity * 2;
+	m_w = ints + capacity * 3;
+	m_pivot_x = ints + capacity * 4;
+	m_pivot_y = ints + capacity * 5;
+	m_locates = locates;
+}
+
+// uniform grid broad-phase over the placed rects, stored as an open addressing
+// hash of cell -> singly linked list of arrange indices. Clear() keeps all the
+// storage, so a generate/reset cycle does not touch the heap once it has warmed up
+class SpatialHash{
+	struct Entry{
+		unsigned int index;
+		unsigned int next;
+	};
+	std::vector<unsigned long long> m_keys;
+	IndexVec m_heads;	// InvalidIndex marks an empty slot
+	std::vector<Entry> m_entries;
+	unsigned int m_used;
+private:
+	static unsigned long long CellKey(int cx, int cy) {
+		return ((unsigned long long)(unsigned int)cx << 32) | (unsigned int)cy;
+	}
+	unsigned int HomeSlot(unsigned long long key) const {
+		return (unsigned int)((key * 0x9E3779B97F4A7C15ULL) >> 32) & (m_keys.size() - 1);
+	}
+	unsigned int FindSlot(unsigned long long key) const;
+	void EraseSlot(unsigned int slot);
+	void Grow();
+public:
+	SpatialHash();
+	void Clear();
+	void Insert(const Rect &rect, unsigned int index);
+	void RemoveLast(const Rect &rect);
+	size_t GetMemoryUsage() const {
+		return m_keys.capacity() * sizeof(unsigned long long) + m_heads.capacity() * sizeof(unsigned int)
+			+ m_entries.capacity() * sizeof(Entry);
+	}
+	// calls fn(index) for every arrange sharing a cell with rect until fn returns false,
+	// an index may be visited more than once when its rect spans several cells
+	template<typename Fn> bool Query(const Rect &rect, Fn fn) const;
+};
+
+SpatialHash::SpatialHash() : m_used(0)
+{
+	m_keys.resize(64, 0);
+	m_heads.resize(64, InvalidIndex);
+}
+
+void SpatialHash::Clear()
+{
+	if (m_used > 0) {
+		std::fill(m_heads.begin(), m_heads.end(), InvalidIndex);
+		m_used = 0;
+	}
+	m_entries.clear();
+}
+
+unsigned int SpatialHash::FindSlot(unsigned long long key) const
+{
+	const unsigned int mask = m_keys.size() - 1;
+	unsigned int slot = HomeSlot(key);
+	while (m_heads[slot] != InvalidIndex && m_keys[slot] != key) {
+		slot = (slot + 1) & mask;
+	}
+	return slot;
+}
+
+// empties a slot and shifts the rest of its probe run back, so no lookup stops early at the hole
+void SpatialHash::EraseSlot(unsigned int slot)
+{
+	const unsigned int mask = m_keys.size() - 1;
+	m_heads[slot] = InvalidIndex;
+	for (unsigned int next = (slot + 1) & mask; m_heads[next] != InvalidIndex; next = (next + 1) & mask) {
+		unsigned int home = HomeSlot(m_keys[next]);
+		if (((next - home) & mask) >= ((next - slot) & mask)) {
+			m_keys[slot] = m_keys[next];
+			m_heads[slot] = m_heads[next];
+			m_heads[next] = InvalidIndex;
+			slot = next;
+		}
+	}
+	--m_used;
+}
+
+void SpatialHash::Grow()
+{
+	std::vector<unsigned long long> keys(m_keys.size() * 2, 0);
+	IndexVec heads(m_heads.size() * 2, InvalidIndex);
+	m_keys.swap(keys);
+	m_heads.swap(heads);
+	for (unsigned int i = 0; i < keys.size(); ++i) {
+		if (heads[i] != InvalidIndex) {
+			unsigned int slot = FindSlot(keys[i]);
+			m_keys[slot] = keys[i];
+			m_heads[slot] = heads[i];
+		}
+	}
+}
+
+void SpatialHash::Insert(const Rect &rect, unsigned int index)
+{
+	int cx0 = rect.x >> SpatialCellShift, cx1 = (rect.x + rect.h - 1) >> SpatialCellShift;
+	int cy0 = rect.y >> SpatialCellShift, cy1 = (rect.y + rect.w - 1) >> SpatialCellShift;
+	for (int cx = cx0; cx <= cx1; ++cx) {
+		for (int cy = cy0; cy <= cy1; ++cy) {
+			if ((m_used + 1) * 2 > m_keys.size()) {
+				Grow();
+			}
+			unsigned long long key = CellKey(cx, cy);
+			unsigned int slot = FindSlot(key);
+			if (m_heads[slot] == InvalidIndex) {
+				m_keys[slot] = key;
+				++m_used;
+			}
+			Entry entry;
+			entry.index = index;
+			entry.next = m_heads[slot];
+			m_heads[slot] = m_entries.size();
+			m_entries.push_back(entry);
+		}
+	}
+}
+
+// undoes the last Insert, "rect" must be the rect it was given
+void SpatialHash::RemoveLast(const Rect &rect)
+{
+	int cx0 = rect.x >> SpatialCellShift, cx1 = (rect.x + rect.h - 1) >> SpatialCellShift;
+	int cy0 = rect.y >> SpatialCellShift, cy1 = (rect.y + rect.w - 1) >> SpatialCellShift;
+	for (int cx = cx1; cx >= cx0; --cx) {
+		for (int cy = cy1; cy >= cy0; --cy) {
+			unsigned int slot = FindSlot(CellKey(cx, cy));
+			assert(m_heads[slot] == m_entries.size() - 1);
+			m_heads[slot] = m_entries.back().next;
+			m_entries.pop_back();
+			if (m_heads[slot] == InvalidIndex) {
+				EraseSlot(slot);
+			}
+		}
+	}
+}
+
+template<typename Fn>
+bool SpatialHash::Query(const Rect &rect, Fn fn) const
+{
+	int cx0 = rect.x >> SpatialCellShift, cx1 = (rect.x + rect.h - 1) >> SpatialCellShift;
+	int cy0 = rect.y >> SpatialCellShift, cy1 = (rect.y + rect.w - 1) >> SpatialCellShift;
+	for (int cx = cx0; cx <= cx1; ++cx) {
+		for (int cy = cy0; cy <= cy1; ++cy) {
+			unsigned int slot = FindSlot(CellKey(cx, cy));
+			for (unsigned int e = m_heads[slot]; e != InvalidIndex; e = m_entries[e].next) {
+				if (!fn(m_entries[e].index)) {
+					return false;
+				}
+			}
+		}
+	}
+	return true;
+}
+
+const int OccupancyBlockShift = 6;
+const int OccupancyBlockSize = 1 << OccupancyBlockShift;	// a block row is one 64 bit word
+
+// cell level occupancy of the world as a sparse bitmap of 64 x 64 cell blocks, so testing a
+// shape costs one or two ANDs per shape row. Tiles and corridors own their cells exclusively,
+// clearing the cells of one undoes setting them. Clear() keeps the blocks' storage
+class OccupancyMap{
+	struct Block{
+		unsigned long long rows[OccupancyBlockSize];
+	};
+	std::vector<unsigned long long> m_keys;
+	IndexVec m_slots;	// block index, InvalidIndex marks an empty slot
+	std::vector<Block> m_blocks;
+private:
+	static unsigned long long BlockKey(int bx, int by) {
+		return ((unsigned long long)(unsigned int)bx << 32) | (unsigned int)by;
+	}
+	unsigned int FindSlot(unsigned long long key) const;
+	unsigned int FindBlock(int bx, int by) const { return m_slots[FindSlot(BlockKey(bx, by))]; }
+	unsigned int AddBlock(int bx, int by);
+	void Grow();
+	void Write(int x, int y, unsigned int h, const unsigned long long *masks, unsigned long long mask, bool set);
+	void WriteRect(const Rect &rect, bool set);
+public:
+	OccupancyMap();
+	void Clear();
+	// a shape is h rows at (x, y), row i covering the columns set in masks[i],
+	// or in "mask" for every row when masks is NULL
+	bool Test(int x, int y, unsigned int h, const unsigned long long *masks, unsigned long long mask) const;
+	void Set(int x, int y, unsigned int h, const unsigned long long *masks) { Write(x, y, h, masks, 0, true); }
+	void Reset(int x, int y, unsigned int h, const unsigned long long *masks) { Write(x, y, h, masks, 0, false); }
+	bool TestRect(const Rect &rect) const;
+	void CopyWindow(int x, int y, unsigned int rows, unsigned long long *out) const;
+	void SetRect(const Rect &rect) { WriteRect(rect, true); }
+	void ResetRect(const Rect &rect) { WriteRect(rect, false); }
+	size_t GetMemoryUsage() const {
+		return m_keys.capacity() * sizeof(unsigned long long) + m_slots.capacity() * sizeof(unsigned int)
+			+ m_blocks.capacity() * sizeof(Block);
+	}
+};
+
+OccupancyMap::OccupancyMap()
+{
+	m_keys.resize(16, 0);
+	m_slots.resize(16, InvalidIndex);
+}
+
+void OccupancyMap::Clear()
+{
+	if (!m_blocks.empty()) {
+		std::fill(m_slots.begin(), m_slots.end(), InvalidIndex);
+		m_blocks.clear();
+	}
+}
+
+unsigned int OccupancyMap::FindSlot(unsigned long long key) const
+{
+	const unsigned int mask = m_keys.size() - 1;
+	unsigned int slot = (unsigned int)((key * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+	while (m_slots[slot] != InvalidIndex && m_keys[slot] != key) {
+		slot = (slot + 1) & mask;
+	}
+	return slot;
+}
+
+void OccupancyMap::Grow()
+{
+	std::vector<unsigned long long> keys(m_keys.size() * 2, 0);
+	IndexVec slots(m_slots.size() * 2, InvalidIndex);
+	m_keys.swap(keys);
+	m_slots.swap(slots);
+	for (unsigned int i = 0; i < keys.size(); ++i) {
+		if (slots[i] != InvalidIndex) {
+			unsigned int slot = FindSlot(keys[i]);
+			m_keys[slot] = keys[i];
+			m_slots[slot] = slots[i];
+		}
+	}
+}
+
+unsigned int OccupancyMap::AddBlock(int bx, int by)
+{
+	unsigned long long key = BlockKey(bx, by);
+	unsigned int slot = FindSlot(key);
+	if (m_slots[slot] == InvalidIndex) {
+		if ((m_blocks.size() + 1) * 2 > m_keys.size()) {
+			Grow();
+			slot = FindSlot(key);
+		}
+		m_keys[slot] = key;
+		m_slots[slot] = m_blocks.size();
+		m_blocks.resize(m_blocks.size() + 1);
+		memset(&m_blocks.back(), 0, sizeof(Block));
+	}
+	return m_slots[slot];
+}
+
+bool OccupancyMap::Test(int x, int y, unsigned int h, const unsigned long long *masks, unsigned long long mask) const
+{
+	const unsigned int shift = y & (OccupancyBlockSize - 1);
+	const int by = y >> OccupancyBlockShift;
+	int bx = (x >> OccupancyBlockShift) - 1;
+	const Block *left = NULL, *right = NULL;
+	for (unsigned int i = 0; i < h; ++i) {
+		int row = x + i;
+		if ((row >> OccupancyBlockShift) != bx) {
+			bx = row >> OccupancyBlockShift;
+			unsigned int idx = FindBlock(bx, by);
+			left = idx == InvalidIndex ? NULL : &m_blocks[idx];
+			idx = shift > 0 ? FindBlock(bx, by + 1) : InvalidIndex;
+			right = idx == InvalidIndex ? NULL : &m_blocks[idx];
+		}
+		unsigned long long bits = masks ? masks[i] : mask;
+		row &= OccupancyBlockSize - 1;
+		if (left && (left->rows[row] & (bits << shift))) {
+			return false;
+		}
+		if (right && (right->rows[row] & (bits >> (OccupancyBlockSize - shift)))) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void OccupancyMap::Write(int x, int y, unsigned int h, const unsigned long long *masks, unsigned long long mask, bool set)
+{
+	const unsigned int shift = y & (OccupancyBlockSize - 1);
+	const int by = y >> OccupancyBlockShift;
+	int bx = (x >> OccupancyBlockShift) - 1;
+	unsigned int left = InvalidIndex, right = InvalidIndex;
+	for (unsigned int i = 0; i < h; ++i) {
+		int row = x + i;
+		if ((row >> OccupancyBlockShift) != bx) {
+			bx = row >> OccupancyBlockShift;
+			left = set ? AddBlock(bx, by) : FindBlock(bx, by);
+			right = shift == 0 ? InvalidIndex : (set ? AddBlock(bx, by + 1) : FindBlock(bx, by + 1));
+		}
+		unsigned long long bits = masks ? masks[i] : mask;
+		row &= OccupancyBlockSize - 1;
+		if (left != InvalidIndex) {
+			unsigned long long &word = m_blocks[left].rows[row];
+			word = set ? word | (bits << shift) : word & ~(bits << shift);
+		}
+		if (right != InvalidIndex) {
+			unsigned long long &word = m_blocks[right].rows[row];
+			word = set ? word | (bits >> (OccupancyBlockSize - shift)) : word & ~(bits >> (OccupancyBlockSize - shift));
+		}
+	}
+}
+
+// rects wider than a block row go in block wide column strips
+bool OccupancyMap::TestRect(const Rect &rect) const
+{
+	for (int y = 0; y < rect.w; y += OccupancyBlockSize) {
+		int w = std::min(rect.w - y, OccupancyBlockSize);
+		unsigned long long mask = w == OccupancyBlockSize ? ~0ULL : (1ULL << w) - 1;
+		if (!Test(rect.x, rect.y + y, rect.h, NULL, mask)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void OccupancyMap::WriteRect(const Rect &rect, bool set)
+{
+	for (int y = 0; y < rect.w; y += OccupancyBlockSize) {
+		int w = std::min(rect.w - y, OccupancyBlockSize);
+		unsigned long long mask = w == OccupancyBlockSize ? ~0ULL : (1ULL << w) - 1;
+		Write(rect.x, rect.y + y, rect.h, NULL, mask, set);
+	}
+}
+
+// bit j of out[i] is set when cell (x + i, y + j) is occupied
+void OccupancyMap::CopyWindow(int x, int y, unsigned int rows, unsigned long long *out) const
+{
+	const unsigned int shift = y & (OccupancyBlockSize - 1);
+	const int by = y >> OccupancyBlockShift;
+	int bx = (x >> OccupancyBlockShift) - 1;
+	const Block *left = NULL, *right = NULL;
+	for (unsigned int i = 0; i < rows; ++i) {
+		int row = x + i;
+		if ((row >> OccupancyBlockShift) != bx) {
+			bx = row >> OccupancyBlockShift;
+			unsigned int idx = FindBlock(bx, by);
+			left = idx == InvalidIndex ? NULL : &m_blocks[idx];
+			idx = shift > 0 ? FindBlock(bx, by + 1) : InvalidIndex;
+			right = idx == InvalidIndex ? NULL : &m_blocks[idx];
+		}
+		row &= OccupancyBlockSize - 1;
+		unsigned long long bits = left ? left->rows[row] >> shift : 0;
+		if (right) {
+			bits |= right->rows[row] << (OccupancyBlockSize - shift);
+		}
+		out[i] = bits;
+	}
+}
+
+// every cell a tile linked at a door can cover is at most this far from the door cell along either axis
+const int OccupancyWindowReach = MaxCorridorLength + MaxTileSize - 1;
+const unsigned int OccupancyWindowRows = OccupancyWindowReach * 2 + 1;
+static_assert(OccupancyWindowRows <= OccupancyBlockSize, "a window row must fit in one word");
+
+// a dense copy of the occupancy around one open door, so that every placement at that door
+// tests against plain words: no block lookup, and the rows of a tile go 4 (AVX2) or 2 (SSE2) at a time
+class OccupancyWindow{
+	int m_x, m_y;	// the cell of bit 0 of m_rows[0]
+	unsigned long long m_rows[OccupancyWindowRows];
+public:
+	OccupancyWindow() : m_x(0), m_y(0) { }
+	void Load(const OccupancyMap &map, const Vector2 &door) {
+		m_x = door.x - OccupancyWindowReach;
+		m_y = door.y - OccupancyWindowReach;
+		map.CopyWindow(m_x, m_y, OccupancyWindowRows, m_rows);
+	}
+	bool Test(int x, int y, unsigned int h, const unsigned long long *masks) const;
+	bool TestRect(const Rect &rect) const;
+};
+
+// OccupancyMap::Test for a shape inside the window
+inline bool OccupancyWindow::Test(int x, int y, unsigned int h, const unsigned long long *masks) const
+{
+	assert(x >= m_x && x + (int)h <= m_x + (int)OccupancyWindowRows && y >= m_y && y + (int)MaxTileSize <= m_y + OccupancyBlockSize);
+	const unsigned long long *rows = m_rows + (x - m_x);
+	const unsigned int shift = y - m_y;
+	unsigned int i = 0;
+#if defined(__AVX2__)
+	const __m128i count = _mm_cvtsi32_si128(shift);
+	for (; i + 4 <= h; i += 4) {
+		__m256i shape = _mm256_sll_epi64(_mm256_loadu_si256((const __m256i*)(masks + i)), count);
+		if (!_mm256_testz_si256(shape, _mm256_loadu_si256((const __m256i*)(rows + i)))) {
+			return false;
+		}
+	}
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+	const __m128i count2 = _mm_cvtsi32_si128(shift);
+	for (; i + 2 <= h; i += 2) {
+		__m128i shape = _mm_sll_epi64(_mm_loadu_si128((const __m128i*)(masks + i)), count2);
+		__m128i hit = _mm_and_si128(shape, _mm_loadu_si128((const __m128i*)(rows + i)));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(hit, _mm_setzero_si128())) != 0xFFFF) {
+			return false;
+		}
+	}
+#endif
+	for (; i < h; ++i) {
+		if (rows[i] & (masks[i] << shift)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+inline bool OccupancyWindow::TestRect(const Rect &rect) const
+{
+	assert(rect.x >= m_x && rect.x + rect.h <= m_x + (int)OccupancyWindowRows && rect.y >= m_y && rect.y + rect.w <= m_y + OccupancyBlockSize);
+	const unsigned long long bits = ((1ULL << rect.w) - 1) << (rect.y - m_y);
+	const unsigned long long *rows = m_rows + (rect.x - m_x);
+	for (int i = 0; i < rect.h; ++i) {
+		if (rows[i] & bits) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// undirected room graph. Edges are appended while a layout is generated and
+// Compact() turns them into compressed sparse row form: the neighbours of room i
+// are targets[offsets[i] .. offsets[i + 1]), in the order their edges were added
+class RoomGraph{
+	struct Edge{
+		unsigned int from, to;
+	};
+	std::vector<Edge> m_edges;
+	IndexVec m_offsets;
+	IndexVec m_targets;
+public:
+	inline unsigned int GetNodeCount() const { return m_offsets.empty() ? 0 : m_offsets.size() - 1; }
+	inline unsigned int GetEdgeCount() const { return m_edges.size(); }
+	inline unsigned int GetDegree(unsigned int i) const { return m_offsets[i + 1] - m_offsets[i]; }
+	inline const unsigned int* GetNeighbors(unsigned int i) const { return m_targets.data() + m_offsets[i]; }
+	void AddEdge(unsigned int from, unsigned int to);
+	void PopEdge() { m_edges.pop_back(); }	// Compact() again afterwards
+	void Compact(unsigned int node_count);
+	void Reserve(unsigned int node_count);
+	void Clear();
+	size_t GetMemoryUsage() const;
+};
+
+void RoomGraph::AddEdge(unsigned int from, unsigned int to)
+{
+	Edge edge;
+	edge.from = from;
+	edge.to = to;
+	m_edges.push_back(edge);
+}
+
+void RoomGraph::Compact(unsigned int node_count)
+{
+	m_offsets.assign(node_count + 1, 0);
+	for (unsigned int i = 0; i < m_edges.size(); ++i) {
+		++m_offsets[m_edges[i].from + 1];
+		++m_offsets[m_edges[i].to + 1];
+	}
+	for (unsigned int i = 0; i < node_count; ++i) {
+		m_offsets[i + 1] += m_offsets[i];
+	}
+
+	// walk the edges in order so each row keeps the insertion order, m_offsets[i] is
+	// used as the fill cursor of row i and ends up at the start of row i + 1
+	m_targets.resize(m_offsets[node_count]);
+	for (unsigned int i = 0; i < m_edges.size(); ++i) {
+		m_targets[m_offsets[m_edges[i].from]++] = m_edges[i].to;
+		m_targets[m_offsets[m_edges[i].to]++] = m_edges[i].from;
+	}
+	for (unsigned int i = node_count; i > 0; --i) {
+		m_offsets[i] = m_offsets[i - 1];
+	}
+	m_offsets[0] = 0;
+}
+
+void RoomGraph::Reserve(unsigned int node_count)
+{
+	m_edges.reserve(node_count);
+	m_offsets.reserve(node_count + 1);
+	m_targets.reserve(node_count * 2);
+}
+
+void RoomGraph::Clear()
+{
+	m_edges.clear();
+	m_offsets.clear();
+	m_targets.clear();
+}
+
+size_t RoomGraph::GetMemoryUsage() const
+{
+	return m_edges.capacity() * sizeof(Edge) + (m_offsets.capacity() + m_targets.capacity()) * sizeof(unsigned int);
+}
+
+// index of the lowest set bit, bits must not be 0
+inline unsigned int LowestBit(unsigned long long bits)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, bits);
+	return index;
+#else
+	return __builtin_ctzll(bits);
+#endif
+}
+
+const unsigned int MaxDistanceRooms = 4096;	// RoomDistances takes 2 * rooms * rooms bytes
+typedef unsigned short HopCount;
+const HopCount UnreachedHops = 0xFFFF;
+
+// hop distances between every pair of rooms, built by a bit-parallel BFS that runs 64 sources
+// at once: bit s of a room's word is set once source s has reached it, so one level of all 64
+// searches is an OR over the edges. A path query then steps from room to room, always to a
+// neighbour one hop closer to the target, without searching or allocating
+class RoomDistances{
+	unsigned int m_count;
+	std::vector<HopCount> m_hops;	// [to * m_count + from]
+	std::vector<unsigned long long> m_visited, m_frontier, m_next;	// Build scratch
+	IndexVec m_active, m_reached;	// rooms with frontier / next bits
+public:
+	RoomDistances() : m_count(0) { }
+	unsigned int GetRoomCount() const { return m_count; }
+	inline unsigned int GetDistance(unsigned int from, unsigned int to) const {
+		HopCount hops = m_hops[to * m_count + from];
+		return hops == UnreachedHops ? INF : hops;
+	}
+	void Build(const RoomGraph &graph);
+	bool GetPath(const RoomGraph &graph, unsigned int from, unsigned int to, IndexVec &path) const;
+	void Clear();
+	size_t GetMemoryUsage() const {
+		return m_hops.capacity() * sizeof(HopCount)
+			+ (m_visited.capacity() + m_frontier.capacity() + m_next.capacity()) * sizeof(unsigned long long)
+			+ (m_active.capacity() + m_reached.capacity()) * sizeof(unsigned int);
+	}
+};
+
+void RoomDistances::Build(const RoomGraph &graph)
+{
+	const unsigned int n = graph.GetNodeCount();
+	assert(n <= MaxDistanceRooms);
+	m_count = n;
+	m_hops.assign((size_t)n * n, UnreachedHops);
+	m_visited.assign(n, 0);
+	m_frontier.assign(n, 0);
+	m_next.assign(n, 0);
+	for (unsigned int base = 0; base < n; base += 64) {
+		const unsigned int batch = std::min(n - base, 64u);
+		std::fill(m_visited.begin(), m_visited.end(), 0);
+		m_active.clear();
+		for (unsigned int s = 0; s < batch; ++s) {
+			m_visited[base + s] = m_frontier[base + s] = 1ULL << s;
+			m_hops[(base + s) * n + base + s] = 0;
+			m_active.push_back(base + s);
+		}
+		// only the rooms next to the frontier are touched, a level costs its frontier's edges
+		for (HopCount level = 1; !m_active.empty(); ++level) {
+			m_reached.clear();
+			for (unsigned int a = 0; a < m_active.size(); ++a) {
+				const unsigned int u = m_active[a];
+				const unsigned int *adj = graph.GetNeighbors(u);
+				for (unsigned int i = 0; i < graph.GetDegree(u); ++i) {
+					const unsigned int v = adj[i];
+					unsigned long long bits = m_frontier[u] & ~m_visited[v];
+					if (bits != 0) {
+						if (m_next[v] == 0) {
+							m_reached.push_back(v);
+						}
+						m_next[v] |= bits;
+						m_visited[v] |= bits;
+					}
+				}
+			}
+			for (unsigned int a = 0; a < m_active.size(); ++a) {
+				m_frontier[m_active[a]] = 0;
+			}
+			for (unsigned int r = 0; r < m_reached.size(); ++r) {
+				const unsigned int v = m_reached[r];
+				// distances are symmetric, so row v takes them all and the writes stay in one cache line
+				HopCount *row = m_hops.data() + (size_t)v * n + base;
+				for (unsigned long long bits = m_next[v]; bits != 0; bits &= bits - 1) {
+					row[LowestBit(bits)] = level;
+				}
+			}
+			m_frontier.swap(m_next);
+			m_active.swap(m_reached);
+		}
+	}
+}
+
+// false when "to" cannot be reached from "from"
+bool RoomDistances::GetPath(const RoomGraph &graph, unsigned int from, unsigned int to, IndexVec &path) const
+{
+	unsigned int hops = GetDistance(from, to);
+	if (hops == INF) {
+		path.clear();
+		return false;
+	}
+	path.resize(hops + 1);
+	path[0] = from;
+	const HopCount *row = m_hops.data() + (size_t)to * m_count;
+	for (unsigned int k = 1; k <= hops; ++k) {
+		const unsigned int *adj = graph.GetNeighbors(path[k - 1]);
+		unsigned int i = 0;
+		while (row[adj[i]] != hops - k) {
+			++i;
+		}
+		path[k] = adj[i];
+	}
+	return true;
+}
+
+void RoomDistances::Clear()
+{
+	m_count = 0;
+	m_hops.clear();
+}
+
+// the map as one row major buffer of GridChar, row 0 / column 0 is world cell (top, left)
+class Raster{
+	int m_top, m_left;
+	unsigned int m_height, m_width;
+	std::vector<char> m_cells;
+public:
+	Raster() : m_top(0), m_left(0), m_height(0), m_width(0) { }
+	void Reset(int top, int left, unsigned int height, unsigned int width) {
+		m_top = top;
+		m_left = left;
+		m_height = height;
+		m_width = width;
+		m_cells.assign((size_t)height * width, GridChar[GridUnused]);
+	}
+	inline int GetTop() const { return m_top; }
+	inline int GetLeft() const { return m_left; }
+	inline unsigned int GetHeight() const { return m_height; }
+	inline unsigned int GetWidth() const { return m_width; }
+	inline const char* GetRow(unsigned int i) const { return m_cells.data() + (size_t)i * m_width; }
+	// world coordinates
+	inline char* GetCell(int x, int y) { return m_cells.data() + (size_t)(x - m_top) * m_width + (y - m_left); }
+	inline char GetCell(int x, int y) const { return m_cells[(size_t)(x - m_top) * m_width + (y - m_left)]; }
+	inline bool Contain(int x, int y) const {
+		return x >= m_top && y >= m_left && x < m_top + (int)m_height && y < m_left + (int)m_width;
+	}
+	size_t GetMemoryUsage() const { return m_cells.capacity(); }
+};
+
+// a corridor end, two per corridor: the door cell it leaves or enters a room through
+struct NavNode{
+	Vector2 cell;
+	unsigned int arrange;	// InvalidIndex for a chunk spine ending on the chunk border
+	unsigned int door;	// index in the variant doors, InvalidIndex for a spine ending on a root wall
+};
+
+// hierarchical cell pathfinding. The abstract graph has the corridor ends as nodes, joined by
+// their corridors and, inside every room, by the precomputed door to door costs of the located
+// tile. The room graph is a tree, so the rooms on the route fix the corridor ends it passes and
+// a query only adds up their costs. The cells of the rooms on the route are only walked when
+// the caller wants them
+class Navigator{
+	struct NavEdge{
+		unsigned int to, cost;
+	};
+	const ArrangeStore *m_arranges;
+	const SpatialHash *m_spatial;
+	std::vector<NavNode> m_nodes;	// m_nodes[2 * i] and [2 * i + 1] are the ends of line i
+	IndexVec m_room_offsets, m_room_nodes;	// the nodes of room a are m_room_nodes[m_room_offsets[a] .. [a + 1])
+	IndexVec m_edge_offsets;
+	std::vector<NavEdge> m_edges;
+	IndexVec m_route;	// query scratch, the corridor ends on the route
+	unsigned int m_start_dist[MaxTileSize * MaxTileSize], m_start_prev[MaxTileSize * MaxTileSize];
+	unsigned int m_goal_dist[MaxTileSize * MaxTileSize], m_goal_prev[MaxTileSize * MaxTileSize];
+	unsigned int m_room_dist[MaxTileSize * MaxTileSize], m_room_prev[MaxTileSize * MaxTileSize];
+private:
+	const TileVariant& GetVariant(unsigned int arrange) const {
+		return m_arranges->GetTile(arrange)->GetVariant(m_arranges->GetLocate(arrange));
+	}
+	Vector2 GetLocal(unsigned int arrange, const Vector2 &cell) const {
+		Rect rect = m_arranges->GetRect(arrange);
+		return Vector2(cell.x - rect.x, cell.y - rect.y);
+	}
+	void AppendRoomCells(unsigned int arrange, const unsigned int *prev, const Vector2 &from, const Vector2 &to, bool reverse,
+		std::vector<Vector2> &cells) const;
+public:
+	Navigator() : m_arranges(NULL), m_spatial(NULL) { }
+	bool IsBuilt() const { return m_arranges != NULL; }
+	unsigned int GetNodeCount() const { return m_nodes.size(); }
+	void Build(const ArrangeStore &arranges, const SpatialHash &spatial, const LineVec &lines);
+	void Clear();
+	unsigned int FindRoom(const Vector2 &cell) const;
+	unsigned int FindPath(const Vector2 &from, const Vector2 &to, const IndexVec &rooms, std::vector<Vector2> *cells);
+	size_t GetMemoryUsage() const;
+};
+
+// the room whose rect holds "cell", InvalidIndex when it is outside every room
+unsigned int Navigator::FindRoom(const Vector2 &cell) const
+{
+	unsigned int found = InvalidIndex;
+	const ArrangeStore &arranges = *m_arranges;
+	m_spatial->Query(Rect(cell.x, cell.y, 1, 1), [&](unsigned int i) {
+		Rect rect = arranges.GetRect(i);
+		if (cell.x >= rect.x && cell.x < rect.x + rect.h && cell.y >= rect.y && cell.y < rect.y + rect.w) {
+			found = i;
+			return false;
+		}
+		return true;
+	});
+	return found;
+}
+
+void Navigator::Build(const ArrangeStore &arranges, const SpatialHash &spatial, const LineVec &lines)
+{
+	m_arranges = &arranges;
+	m_spatial = &spatial;
+	const unsigned int room_count = arranges.Size();
+
+	m_nodes.resize(lines.size() * 2);
+	m_room_offsets.assign(room_count + 1, 0);
+	for (unsigned int i = 0; i < m_nodes.size(); ++i) {
+		NavNode &node = m_nodes[i];
+		node.cell = (i % 2 == 0) ? lines[i / 2].start : lines[i / 2].end;
+		node.arrange = FindRoom(node.cell);
+		node.door = InvalidIndex;
+		if (node.arrange == InvalidIndex) {
+			continue;
+		}
+		Vector2 local = GetLocal(node.arrange, node.cell);
+		const TileVariant &variant = GetVariant(node.arrange);
+		for (unsigned int k = 0; k < variant.m_door_count; ++k) {
+			if (variant.m_doors[k].locate - variant.m_offset == local) {
+				node.door = k;
+			}
+		}
+		++m_room_offsets[node.arrange + 1];
+	}
+	for (unsigned int a = 0; a < room_count; ++a) {
+		m_room_offsets[a + 1] += m_room_offsets[a];
+	}
+	m_room_nodes.resize(m_room_offsets[room_count]);
+	for (unsigned int i = 0; i < m_nodes.size(); ++i) {
+		if (m_nodes[i].arrange != InvalidIndex) {
+			m_room_nodes[m_room_offsets[m_nodes[i].arrange]++] = i;
+		}
+	}
+	for (unsigned int a = room_count; a > 0; --a) {
+		m_room_offsets[a] = m_room_offsets[a - 1];
+	}
+	m_room_offsets[0] = 0;
+
+	// every node has its corridor and the other corridor ends of its room as neighbours
+	m_edge_offsets.resize(m_nodes.size() + 1);
+	m_edges.clear();
+	for (unsigned int i = 0; i < m_nodes.size(); ++i) {
+		m_edge_offsets[i] = m_edges.size();
+		const NavNode &node = m_nodes[i];
+		const NavNode &other = m_nodes[i ^ 1];
+		NavEdge edge;
+		edge.to = i ^ 1;
+		edge.cost = std::abs(node.cell.x - other.cell.x) + std::abs(node.cell.y - other.cell.y);
+		m_edges.push_back(edge);
+		if (node.arrange == InvalidIndex) {
+			continue;
+		}
+		const TileVariant &variant = GetVariant(node.arrange);
+		bool searched = false;
+		for (unsigned int r = m_room_offsets[node.arrange]; r < m_room_offsets[node.arrange + 1]; ++r) {
+			const NavNode &mate = m_nodes[m_room_nodes[r]];
+			if (m_room_nodes[r] == i) {
+				continue;
+			}
+			if (node.door != InvalidIndex && mate.door != InvalidIndex) {
+				edge.cost = variant.m_door_costs[node.door][mate.door];
+			}
+			else{
+				// a spine end on a root wall is no tile door, search from it
+				if (!searched) {
+					SearchVariant(variant, GetLocal(node.arrange, node.cell), m_room_dist, m_room_prev);
+					searched = true;
+				}
+				Vector2 local = GetLocal(node.arrange, mate.cell);
+				edge.cost = m_room_dist[local.x * MaxTileSize + local.y];
+			}
+			if (edge.cost != INF) {
+				edge.to = m_room_nodes[r];
+				m_edges.push_back(edge);
+			}
+		}
+	}
+	m_edge_offsets[m_nodes.size()] = m_edges.size();
+	m_route.reserve(m_nodes.size());
+}
+
+void Navigator::Clear()
+{
+	m_arranges = NULL;
+	m_spatial = NULL;
+	m_nodes.clear();
+	m_room_offsets.clear();
+	m_room_nodes.clear();
+	m_edge_offsets.clear();
+	m_edges.clear();
+}
+
+// appends the cells of a shortest walk from "from" to "to" inside a room, leaving "from" out.
+// prev comes from a search rooted at "to" when reverse is set, at "from" otherwise
+void Navigator::AppendRoomCells(unsigned int arrange, const unsigned int *prev, const Vector2 &from, const Vector2 &to, bool reverse,
+								std::vector<Vector2> &cells) const
+{
+	Rect rect = m_arranges->GetRect(arrange);
+	Vector2 local_from = GetLocal(arrange, from), local_to = GetLocal(arrange, to);
+	unsigned int first = local_from.x * MaxTileSize + local_from.y;
+	unsigned int last = local_to.x * MaxTileSize + local_to.y;
+	if (reverse) {
+		for (unsigned int cur = first; cur != last; ) {
+			cur = prev[cur];
+			cells.push_back(Vector2(rect.x + cur / MaxTileSize, rect.y + cur % MaxTileSize));
+		}
+	}
+	else{
+		size_t begin = cells.size();
+		for (unsigned int cur = last; cur != first; cur = prev[cur]) {
+			cells.push_back(Vector2(rect.x + cur / MaxTileSize, rect.y + cur % MaxTileSize));
+		}
+		std::reverse(cells.begin() + begin, cells.end());
+	}
+}
+
+// the number of steps of a shortest walk between two floor or door cells of rooms, through
+// "rooms", the room route between them from Graph::FindPath. INF when there is none.
+// "cells" gets the walk, both ends included, unless it is NULL
+unsigned int Navigator::FindPath(const Vector2 &from, const Vector2 &to, const IndexVec &rooms, std::vector<Vector2> *cells)
+{
+	if (rooms.empty()) {
+		return INF;
+	}
+	const unsigned int room_from = rooms.front(), room_to = rooms.back();
+	Vector2 local_from = GetLocal(room_from, from), local_to = GetLocal(room_to, to);
+	SearchVariant(GetVariant(room_from), local_from, m_start_dist, m_start_prev);
+	if (rooms.size() == 1) {
+		unsigned int best = m_start_dist[local_to.x * MaxTileSize + local_to.y];
+		if (best != INF && cells != NULL) {
+			cells->clear();
+			cells->push_back(from);
+			AppendRoomCells(room_from, m_start_prev, from, to, false, *cells);
+		}
+		return best;
+	}
+
+	// the corridor ends the route passes: out of every room but the last, into every room but the first
+	m_route.clear();
+	for (unsigned int k = 0; k + 1 < rooms.size(); ++k) {
+		unsigned int exit = InvalidIndex;
+		for (unsigned int r = m_room_offsets[rooms[k]]; r < m_room_offsets[rooms[k] + 1] && exit == InvalidIndex; ++r) {
+			if (m_nodes[m_room_nodes[r] ^ 1].arrange == rooms[k + 1]) {
+				exit = m_room_nodes[r];
+			}
+		}
+		assert(exit != InvalidIndex);
+		m_route.push_back(exit);
+		m_route.push_back(exit ^ 1);
+	}
+
+	Vector2 local = GetLocal(room_from, m_nodes[m_route.front()].cell);
+	unsigned int best = m_start_dist[local.x * MaxTileSize + local.y];
+	for (unsigned int k = 1; k < m_route.size() && best != INF; ++k) {
+		unsigned int a = m_route[k - 1], b = m_route[k], cost = INF;
+		for (unsigned int e = m_edge_offsets[a]; e < m_edge_offsets[a + 1]; ++e) {
+			if (m_edges[e].to == b) {
+				cost = m_edges[e].cost;
+			}
+		}
+		best = cost == INF ? INF : best + cost;
+	}
+	if (best == INF) {
+		return INF;
+	}
+	SearchVariant(GetVariant(room_to), local_to, m_goal_dist, m_goal_prev);
+	local = GetLocal(room_to, m_nodes[m_route.back()].cell);
+	if (m_goal_dist[local.x * MaxTileSize + local.y] == INF) {
+		return INF;
+	}
+	best += m_goal_dist[local.x * MaxTileSize + local.y];
+	if (cells == NULL) {
+		return best;
+	}
+
+	// refine: walk the cells of the rooms and corridors on the route
+	cells->clear();
+	cells->push_back(from);
+	AppendRoomCells(room_from, m_start_prev, from, m_nodes[m_route[0]].cell, false, *cells);
+	for (unsigned int k = 1; k < m_route.size(); ++k) {
+		const NavNode &a = m_nodes[m_route[k - 1]], &b = m_nodes[m_route[k]];
+		if ((m_route[k - 1] ^ 1) == m_route[k]) {
+			// along the corridor, one cell at a time
+			Vector2 step((b.cell.x > a.cell.x) - (b.cell.x < a.cell.x), (b.cell.y > a.cell.y) - (b.cell.y < a.cell.y));
+			for (Vector2 cell = a.cell + step; !(cell == b.cell); cell = cell + step) {
+				cells->push_back(cell);
+			}
+			cells->push_back(b.cell);
+		}
+		else{
+			SearchVariant(GetVariant(a.arrange), GetLocal(a.arrange, a.cell), m_room_dist, m_room_prev);
+			AppendRoomCells(a.arrange, m_room_prev, a.cell, b.cell, false, *cells);
+		}
+	}
+	AppendRoomCells(room_to, m_goal_prev, m_nodes[m_route.back()].cell, to, true, *cells);
+	return best;
+}
+
+size_t Navigator::GetMemoryUsage() const
+{
+	return m_nodes.capacity() * sizeof(NavNode) + m_edges.capacity() * sizeof(NavEdge)
+		+ (m_room_offsets.capacity() + m_room_nodes.capacity() + m_edge_offsets.capacity() + m_route.capacity()) * sizeof(unsigned int);
+}
+
+const unsigned int FrontierComboCount = MaxCorridorLength * 2;	// corridor lengths x the two locate choices, at most
+typedef unsigned short FrontierMask;
+
+// what is known about the open doors, kept parallel to the open door list. For every door
+// and every (tile, tile door) slot a mask holds the corridor length / locate choice
+// combinations known not to fit. Placing tiles only ever blocks more, so a mask stays valid
+// until a nearby tile is taken back. A tile that fits nowhere at a door is dropped from the
+// door's live list, so a search for that tile never visits the door again
+class DoorFrontier{
+	unsigned int m_tile_count;
+	unsigned int m_slot_count;	// masks per door, one per (tile, tile door)
+	std::vector<FrontierMask> m_blocked;	// [door * m_slot_count + slot]
+	std::vector<IndexVec> m_live;	// [tile] the doors the tile may still fit at
+	IndexVec m_live_pos;	// [door * m_tile_count + tile] position in m_live[tile], InvalidIndex when dead
+private:
+	void AddLive(unsigned int door, unsigned int tile);
+	void MoveDoor(unsigned int from, unsigned int to);
+	void PushRows();
+	void PopRows();
+public:
+	DoorFrontier() : m_tile_count(0), m_slot_count(0) { }
+	unsigned int GetTileCount() const { return m_tile_count; }
+	unsigned int GetSlotCount() const { return m_slot_count; }
+	unsigned int GetDoorCount() const { return m_tile_count ? m_live_pos.size() / m_tile_count : 0; }
+	void SetTiles(unsigned int tile_count, unsigned int slot_count);	// only while there are no doors
+	void Clear();
+	void Reserve(unsigned int door_count);
+	// mirror the open door list: push, swap-remove, take back a swap-remove and pop
+	void PushDoor();
+	void RemoveDoor(unsigned int door);
+	void InsertDoor(unsigned int door);
+	void PopDoor();
+	inline bool IsBlocked(unsigned int door, unsigned int slot, unsigned int combo) const {
+		return (m_blocked[door * m_slot_count + slot] >> combo) & 1;
+	}
+	inline void Block(unsigned int door, unsigned int slot, unsigned int combo) {
+		m_blocked[door * m_slot_count + slot] |= (FrontierMask)(1 << combo);
+	}
+	void Kill(unsigned int door, unsigned int tile);
+	void Revive(unsigned int door);	// forget everything known about the door
+	const IndexVec& GetLive(unsigned int tile) const { return m_live[tile]; }
+	inline bool IsLive(unsigned int door, unsigned int tile) const { return m_live_pos[door * m_tile_count + tile] != InvalidIndex; }
+	size_t GetMemoryUsage() const;
+};
+
+void DoorFrontier::SetTiles(unsigned int tile_count, unsigned int slot_count)
+{
+	assert(m_live_pos.empty());
+	m_tile_count = tile_count;
+	m_slot_count = slot_count;
+	m_live.resize(m_tile_count);
+}
+
+void DoorFrontier::Clear()
+{
+	m_blocked.clear();
+	m_live_pos.clear();
+	for (unsigned int t = 0; t < m_live.size(); ++t) {
+		m_live[t].clear();
+	}
+}
+
+void DoorFrontier::Reserve(unsigned int door_count)
+{
+	m_blocked.reserve(door_count * m_slot_count);
+	m_live_pos.reserve(door_count * m_tile_count);
+	for (unsigned int t = 0; t < m_live.size(); ++t) {
+		m_live[t].reserve(door_count);
+	}
+}
+
+void DoorFrontier::AddLive(unsigned int door, unsigned int tile)
+{
+	m_live_pos[door * m_tile_count + tile] = m_live[tile].size();
+	m_live[tile].push_back(door);
+}
+
+void DoorFrontier::Kill(unsigned int door, unsigned int tile)
+{
+	unsigned int pos = m_live_pos[door * m_tile_count + tile];
+	if (pos == InvalidIndex) {
+		return;
+	}
+	unsigned int last = m_live[tile].back();
+	m_live[tile][pos] = last;
+	m_live_pos[last * m_tile_count + tile] = pos;
+	m_live[tile].pop_back();
+	m_live_pos[door * m_tile_count + tile] = InvalidIndex;
+}
+
+void DoorFrontier::Revive(unsigned int door)
+{
+	std::fill(m_blocked.begin() + door * m_slot_count, m_blocked.begin() + (door + 1) * m_slot_count, 0);
+	for (unsigned int t = 0; t < m_tile_count; ++t) {
+		if (m_live_pos[door * m_tile_count + t] == InvalidIndex) {
+			AddLive(door, t);
+		}
+	}
+}
+
+// "to" takes over the masks and live entries of "from", "to" must be dead for every tile
+void DoorFrontier::MoveDoor(unsigned int from, unsigned int to)
+{
+	std::copy(m_blocked.begin() + from * m_slot_count, m_blocked.begin() + (from + 1) * m_slot_count,
+		m_blocked.begin() + to * m_slot_count);
+	for (unsigned int t = 0; t < m_tile_count; ++t) {
+		unsigned int pos = m_live_pos[from * m_tile_count + t];
+		m_live_pos[to * m_tile_count + t] = pos;
+		m_live_pos[from * m_tile_count + t] = InvalidIndex;
+		if (pos != InvalidIndex) {
+			m_live[t][pos] = to;
+		}
+	}
+}
+
+void DoorFrontier::PushRows()
+{
+	m_blocked.resize(m_blocked.size() + m_slot_count, 0);
+	m_live_pos.resize(m_live_pos.size() + m_tile_count, InvalidIndex);
+}
+
+void DoorFrontier::PopRows()
+{
+	m_blocked.resize(m_blocked.size() - m_slot_count);
+	m_live_pos.resize(m_live_pos.size() - m_tile_count);
+}
+
+void DoorFrontier::PushDoor()
+{
+	PushRows();
+	Revive(GetDoorCount() - 1);
+}
+
+void DoorFrontier::RemoveDoor(unsigned int door)
+{
+	unsigned int last = GetDoorCount() - 1;
+	for (unsigned int t = 0; t < m_tile_count; ++t) {
+		Kill(door, t);
+	}
+	if (door != last) {
+		MoveDoor(last, door);
+	}
+	PopRows();
+}
+
+// the door now at "door" moves to the end and "door" starts over as a new door
+void DoorFrontier::InsertDoor(unsigned int door)
+{
+	PushRows();
+	unsigned int last = GetDoorCount() - 1;
+	if (door != last) {
+		MoveDoor(door, last);
+	}
+	Revive(door);
+}
+
+void DoorFrontier::PopDoor()
+{
+	unsigned int last = GetDoorCount() - 1;
+	for (unsigned int t = 0; t < m_tile_count; ++t) {
+		Kill(last, t);
+	}
+	PopRows();
+}
+
+size_t DoorFrontier::GetMemoryUsage() const
+{
+	size_t size = m_blocked.capacity() * sizeof(FrontierMask) + m_live_pos.capacity() * sizeof(unsigned int);
+	for (unsigned int t = 0; t < m_live.size(); ++t) {
+		size += m_live[t].capacity() * sizeof(unsigned int);
+	}
+	return size;
+}
+
+// what a Graph spent its generation time on, only collected when built with GENERATION_STATS
+// defined. Timers are in nanoseconds and may nest, e.g. door_ns is also part of close_ns
+struct GenStats{
+	unsigned long long exact_calls, exact_successes;	// GenExact
+	unsigned long long gen_attempts, gen_failures;	// RandomGen, a failure leaves GenExact a layout to repair
+	unsigned long long candidates;	// DrawCombo calls
+	unsigned long long overlap_tests, overlap_rejects;	// CheckTile, FitCandidate and TestDoorBatch
+	unsigned long long corridor_tests, corridor_rejects;	// CheckCorridor, FitCandidate and TestDoorBatch
+	unsigned long long fallback_scans, fallback_candidates, fallback_failures;	// exhaustive loop in GrowTiles
+	unsigned long long dead_picks;	// tiles drawn again because they fit nowhere at the door
+	unsigned long long end_tile_tries, end_tile_fails;	// CloseDoors
+	unsigned long long repair_rounds, rolled_back;	// GenExact repairs and the tiles they took back
+	unsigned long long tiles_placed;
+	unsigned long long gen_ns, candidate_ns, overlap_ns, door_ns, close_ns;	// candidate_ns is FitNewTile and TestDoorBatch, overlap_ns included
+
+	GenStats() { Reset(); }
+	void Reset() { memset(this, 0, sizeof(GenStats)); }
+	void Add(const GenStats &stats);
+	void Print(std::ostream &out) const;
+};
+
+void GenStats::Add(const GenStats &stats)
+{
+	const unsigned long long *src = (const unsigned long long*)&stats;
+	unsigned long long *dst = (unsigned long long*)this;
+	for (unsigned int i = 0; i < sizeof(GenStats) / sizeof(unsigned long long); ++i) {
+		dst[i] += src[i];
+	}
+}
+
+void GenStats::Print(std::ostream &out) const
+{
+	out<<"GenExact calls/successes:    "<<exact_calls<<" / "<<exact_successes<<"\n";
+	out<<"RandomGen calls/failures:    "<<gen_attempts<<" / "<<gen_failures<<"\n";
+	out<<"candidates:                  "<<candidates<<"\n";
+	out<<"overlap tests/rejects:       "<<overlap_tests<<" / "<<overlap_rejects<<"\n";
+	out<<"corridor tests/rejects:      "<<corridor_tests<<" / "<<corridor_rejects<<"\n";
+	out<<"fallback scans/candidates/failures: "<<fallback_scans<<" / "<<fallback_candidates<<" / "<<fallback_failures<<"\n";
+	out<<"dead tile picks:             "<<dead_picks<<"\n";
+	out<<"end tiles tried/failed:      "<<end_tile_tries<<" / "<<end_tile_fails<<"\n";
+	out<<"repair rounds/rolled back:   "<<repair_rounds<<" / "<<rolled_back<<"\n";
+	out<<"tiles placed:                "<<tiles_placed<<"\n";
+	out<<"ms generate/candidate/overlap/door/close: "<<gen_ns * 1e-6<<" / "<<candidate_ns * 1e-6<<" / "
+		<<overlap_ns * 1e-6<<" / "<<door_ns * 1e-6<<" / "<<close_ns * 1e-6<<"\n";
+}
+
+#ifdef GENERATION_STATS
+// adds the lifetime of the scope to a GenStats timer
+class ScopedStatTimer{
+	unsigned long long &m_target;
+	std::chrono::steady_clock::time_point m_start;
+public:
+	explicit ScopedStatTimer(unsigned long long &target) : m_target(target), m_start(std::chrono::steady_clock::now()) { }
+	~ScopedStatTimer() {
+		m_target += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count();
+	}
+};
+#define STATS_ADD(name, n) (m_stats.name += (n))
+#define STATS_TIMER(name) ScopedStatTimer stats_timer_##name(m_stats.name)
+#else
+#define STATS_ADD(name, n) ((void)0)
+#define STATS_TIMER(name) ((void)0)
+#endif
+
+// how ChooseLinkTile and ChooseEndTile weigh the tiles. door_shares[k] is the share of the link picks
+// that go to tiles with k + 1 doors: [0] above 0 lets dead ends grow in the middle of a dungeon, raising
+// [2] and [3] gives more hubs. Within its share a tile counts Tile::m_weight times (area / mean area of
+// the share) ^ area_power, so area_power below 0 favours small rooms, which still fit in crowded spots
+struct TileMix{
+	double door_shares[MaxDoorCount];
+	double area_power;
+	TileMix() : area_power(0.0) {
+		door_shares[0] = 0.0;
+		for (unsigned int i = 1; i < MaxDoorCount; ++i) {
+			door_shares[i] = 1.0;
+		}
+	}
+};
+
+const unsigned int MaxTilePicks = 4;	// draws per link or end tile before taking one that may not fit
+
+const unsigned int MaxDoorCandidates = MaxDoorCount * MaxCorridorLength * 2;
+
+// the placements of one tile at one open door, one array per field so building and testing
+// them are two plain passes, see Graph::TestDoorBatch
+struct CandidateBatch{
+	unsigned int count;
+	unsigned char dst_doors[MaxDoorCandidates];	// the tile door that meets the open door
+	unsigned char combos[MaxDoorCandidates];	// DoorFrontier combination
+	unsigned char locates[MaxDoorCandidates];	// LocateMode
+	int xs[MaxDoorCandidates], ys[MaxDoorCandidates];	// topleft of the located rect
+	bool fits[MaxDoorCandidates];
+};
+
+// the open door an arrange was linked to and where it sat in the open door list, so the
+// placement can be taken back. The root has no door, src_door_idx is InvalidIndex
+struct Placement{
+	Door src_door;
+	unsigned int src_door_idx;
+};
+
+typedef std::vector<Placement> PlacementVec;
+
+// varints are little endian groups of 7 bits, the top bit is set on every group but the last
+inline void PutVarint(std::vector<unsigned char> &out, unsigned long long value)
+{
+	while (value >= 0x80) {
+		out.push_back((unsigned char)(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back((unsigned char)value);
+}
+
+inline unsigned long long GetVarint(const unsigned char *&p)
+{
+	unsigned long long value = 0;
+	for (unsigned int shift = 0; ; shift += 7) {
+		unsigned char byte = *p++;
+		value |= (unsigned long long)(byte & 0x7F) << shift;
+		if (byte < 0x80) {
+			return value;
+		}
+	}
+}
+
+// signed values for varints, small magnitudes of either sign stay small: 0, -1, 1, -2 -> 0, 1, 2, 3
+inline unsigned int ZigZag(int value) { return ((unsigned int)value << 1) ^ (unsigned int)(value >> 31); }
+inline int UnZigZag(unsigned int value) { return (int)(value >> 1) ^ -(int)(value & 1); }
+
+const unsigned int CompactPaletteSize = 32;	// tile types one layout may use, the top 5 bits of a room byte
+const unsigned int CompactBlockShift = 5;
+const unsigned int CompactBlockSize = 1 << CompactBlockShift;	// rooms between two checkpoints
+
+static_assert(LocateModeCount <= 8 && MaxDoorCount <= 4, "a room byte keeps the LocateMode in 3 bits, links keep doors in 2");
+
+// a room as CompactLayout reads it back, parent is InvalidIndex for the root
+struct CompactRoom{
+	unsigned int type_id;
+	unsigned int palette;	// index of type_id in the palette of the layout
+	LocateMode locate;
+	Vector2 pivot;
+	unsigned int parent;
+	unsigned int parent_door, door;	// the corridor runs from this door of the parent to this door of the room
+};
+
+// a finished layout in a few bytes per room, for keeping very many of them in memory. One buffer holds
+//   palette: the tile type ids the layout uses
+//   spines: the corridors of no room (see Graph::GenChunk) as 4 zigzag varints each
+//   rooms: a byte per room, palette index << 3 | LocateMode
+//   checkpoints: the stream offset of every CompactBlockSize-th room
+//   stream: per room its pivot as zigzag varints, relative to the room before except at a checkpoint,
+//           then for all but the root the varint (room - parent) << 4 | parent door << 2 | door
+// Each room hangs off its parent by one corridor between two of their doors, so the room graph and the
+// corridors are not stored, Graph::Decode derives them. Reading a room walks at most a block of others
+class CompactLayout{
+	std::vector<unsigned char> m_data;
+	unsigned int m_room_count;
+	unsigned int m_palette_size;
+	unsigned int m_spine_count;
+	unsigned int m_rooms_offset;
+private:
+	unsigned int GetCheckpoint(unsigned int block) const;
+	void ReadRoom(const unsigned char *&p, unsigned int i, CompactRoom &room) const;
+	const unsigned char* GetStream() const {
+		return m_data.data() + m_rooms_offset + m_room_count + ((m_room_count + CompactBlockSize - 1) >> CompactBlockShift) * 4;
+	}
+public:
+	CompactLayout() : m_room_count(0), m_palette_size(0), m_spine_count(0), m_rooms_offset(0) { }
+	unsigned int GetRoomCount() const { return m_room_count; }
+	unsigned int GetPaletteSize() const { return m_palette_size; }
+	unsigned int GetPaletteId(unsigned int i) const;
+	unsigned int GetTypeId(unsigned int i) const { return GetPaletteId(m_data[m_rooms_offset + i] >> 3); }
+	LocateMode GetLocate(unsigned int i) const { return (LocateMode)(m_data[m_rooms_offset + i] & 7); }
+	CompactRoom GetRoom(unsigned int i) const;
+	template<typename Fn>
+	void ForEachRoom(Fn fn) const;	// fn(i, room) for every room in order, cheaper than GetRoom on each
+	unsigned int GetSpineCount() const { return m_spine_count; }
+	Line GetSpine(unsigned int i) const;
+	void Clear();
+	size_t GetMemoryUsage() const { return sizeof(*this) + m_data.capacity(); }
+	friend class Graph;
+};
+
+unsigned int CompactLayout::GetPaletteId(unsigned int i) const
+{
+	unsigned int id;
+	memcpy(&id, m_data.data() + i * sizeof(id), sizeof(id));
+	return id;
+}
+
+unsigned int CompactLayout::GetCheckpoint(unsigned int block) const
+{
+	unsigned int offset;
+	memcpy(&offset, m_data.data() + m_rooms_offset + m_room_count + block * sizeof(offset), sizeof(offset));
+	return offset;
+}
+
+// "p" points at room "i" in the stream, "room" holds room i - 1 unless i starts a block
+inline void CompactLayout::ReadRoom(const unsigned char *&p, unsigned int i, CompactRoom &room) const
+{
+	unsigned char kind = m_data[m_rooms_offset + i];
+	room.palette = kind >> 3;
+	room.type_id = GetPaletteId(room.palette);
+	room.locate = (LocateMode)(kind & 7);
+	int dx = UnZigZag((unsigned int)GetVarint(p));
+	int dy = UnZigZag((unsigned int)GetVarint(p));
+	if ((i & (CompactBlockSize - 1)) == 0) {
+		room.pivot.Set(dx, dy);
+	}
+	else{
+		room.pivot.Set(room.pivot.x + dx, room.pivot.y + dy);
+	}
+	if (i == 0) {
+		room.parent = InvalidIndex;
+		room.parent_door = room.door = 0;
+	}
+	else{
+		unsigned long long link = GetVarint(p);
+		room.parent = i - (unsigned int)(link >> 4);
+		room.parent_door = (unsigned int)(link >> 2) & 3;
+		room.door = (unsigned int)link & 3;
+	}
+}
+
+CompactRoom CompactLayout::GetRoom(unsigned int i) const
+{
+	assert(i < m_room_count);
+	const unsigned int block = i >> CompactBlockShift;
+	const unsigned char *p = GetStream() + GetCheckpoint(block);
+	CompactRoom room;
+	for (unsigned int k = block << CompactBlockShift; k <= i; ++k) {
+		ReadRoom(p, k, room);
+	}
+	return room;
+}
+
+template<typename Fn>
+void CompactLayout::ForEachRoom(Fn fn) const
+{
+	const unsigned char *p = GetStream();
+	CompactRoom room;
+	for (unsigned int i = 0; i < m_room_count; ++i) {
+		ReadRoom(p, i, room);
+		fn(i, room);
+	}
+}
+
+Line CompactLayout::GetSpine(unsigned int i) const
+{
+	assert(i < m_spine_count);
+	// the spines before it are 4 varints each, read past them
+	const unsigned char *p = m_data.data() + m_palette_size * sizeof(unsigned int);
+	int values[4];
+	for (unsigned int k = 0; k <= i; ++k) {
+		for (unsigned int j = 0; j < 4; ++j) {
+			values[j] = UnZigZag((unsigned int)GetVarint(p));
+		}
+	}
+	Line line;
+	line.start.Set(values[0], values[1]);
+	line.end.Set(values[2], values[3]);
+	return line;
+}
+
+void CompactLayout::Clear()
+{
+	m_data.clear();
+	m_room_count = m_palette_size = m_spine_count = m_rooms_offset = 0;
+}
+
+class Graph{
+	ArrangeStore m_arranges;
+	PlacementVec m_placements;	// parallel to m_arranges
+	SpatialHash m_spatial;
+	RoomGraph m_adj_list;
+	IndexVec m_path_dist;	// FindPath scratch, kept to avoid reallocating per query
+	IndexVec m_path_prev;
+	IndexVec m_path_queue;
+	RoomDistances m_distances;	// built on request by BuildDistances
+	Navigator m_navigator;	// built on the first FindCellPath
+	IndexVec m_cell_rooms;	// FindCellPath scratch
+	TileCatalogPtr m_catalog;
+	TileMix m_mix;
+	ConstTileVec m_link_tiles, m_end_tiles;	// the columns of the alias tables
+	AliasTable m_link_table, m_end_table;
+	DoorVec m_open_doors;
+	DoorFrontier m_frontier;	// parallel to m_open_doors
+	LineVec m_lines;
+	Raster m_raster;
+	Random m_random;
+	unsigned long long m_seed;
+	unsigned int m_cur_tile_count;
+	OccupancyMap m_occupancy;	// cells of the placed tiles and corridors
+	OccupancyWindow m_window;	// TestDoorBatch scratch
+	CandidateBatch m_batch;
+	Rect m_bounds;	// tiles must lie inside when m_bounds.h > 0
+	unsigned int m_rolled_back;	// tiles taken back by the last GenExact
+	unsigned int m_attempts;	// RandomGen and repair rounds of the last GenExact
+	unsigned int m_corridor_length;	// corridors are 1 to this many cells long
+	mutable GenStats m_stats;
+private:
+	void BuildTileTables();
+	unsigned int FindArrange(const Vector2 &coord);
+	Rect GetTileRect(const Tile *tile, const Vector2 &coord, LocateMode loca_mode) const;
+	bool InBounds(int x, int y, unsigned int h, unsigned int w) const {
+		return m_bounds.h <= 0 || (x >= m_bounds.x && y >= m_bounds.y
+			&& x + (int)h <= m_bounds.x + m_bounds.h && y + (int)w <= m_bounds.y + m_bounds.w);
+	}
+	bool CheckTile(const Tile *tile, const Vector2 &coord, LocateMode loca_mode) const;
+	bool CheckCorridor(const Vector2 &start, const Vector2 &end) const;
+	void LinkTile(unsigned int arr_idx, const Tile *tile, const Vector2 &coord, LocateMode loca_mode);
+	void AddDoors(const Tile *tile, const Vector2 &coord, LocateMode loca_mode, unsigned int exclude_door_idx = InvalidIndex);
+	void DelDoor(unsigned int idx);
+	void PlaceTile(unsigned int src_door_idx, const Tile *tile, unsigned int dst_door_idx, const Vector2 &door_pos,
+		const Vector2 &coord, LocateMode loca_mode);
+	void RemoveTiles(unsigned int count);
+	void AddLink(const Vector2 &start, const Vector2 &end);
+	const Tile* ChooseEndTile(unsigned int door_idx);
+	const Tile* ChooseLinkTile(unsigned int src_door_idx = InvalidIndex);
+	unsigned int DrawCombo();
+	bool FitNewTile(const Door *src_door, const Tile *tile, unsigned int dst_door_idx, unsigned int combo,
+		Vector2 &door_pos, Vector2 &coord, LocateMode &loca_mode) const;
+	unsigned int TestDoorBatch(unsigned int door, const Tile *tile, CandidateBatch &batch);
+	void PlaceBatchCandidate(unsigned int door, const Tile *tile, const CandidateBatch &batch, unsigned int n);
+	template <DoorDirection S, LocateMode M>
+	bool FitCandidate(const Door &src_door, const Tile *tile, unsigned int dst_door_idx, unsigned int len,
+		Vector2 &door_pos, Vector2 &coord) const;
+	void LocateNewTile(const Door *src_door, const Tile *tile, unsigned int dst_door_idx, unsigned int len, unsigned int choice,
+		Vector2 &door_pos, Vector2 &coord, LocateMode &loca_mode) const;
+	void GrowTiles(unsigned int tile_count);
+	void CloseDoors(unsigned int tile_count);
+public:
+	explicit Graph(const TileCatalogPtr &catalog = TileCatalog::GetBuiltin());
+	~Graph();
+	void Reset();
+	bool SetCatalog(const TileCatalogPtr &catalog);
+	const TileCatalogPtr& GetCatalog() const { return m_catalog; }
+	bool LoadTiles(const char *dir, const char *cache_path = NULL);	// TileCatalog::Load, then SetCatalog
+	bool SetTileMix(const TileMix &mix);
+	const TileMix& GetTileMix() const { return m_mix; }
+	void Seed(unsigned long long seed);
+	unsigned long long GetSeed() const { return m_seed; }
+	bool RandomGen(unsigned int tile_count);
+	bool RandomGen(unsigned int tile_count, unsigned long long seed);
+	bool GenExact(unsigned int tile_count, unsigned int max_rounds = DefaultExactRounds); // a RandomGen and up to "max_rounds" - 1 repairs to get exactly "tile_count" tiles
+	unsigned int GetRolledBack() const { return m_rolled_back; }
+	unsigned int GetAttempts() const { return m_attempts; }
+	bool SetCorridorLength(unsigned int length);	// between generations, 1 to MaxCorridorLength
+	unsigned int GetCorridorLength() const { return m_corridor_length; }
+	unsigned int GenChunk(const Rect &bounds, unsigned int tile_count, unsigned long long seed);
+	bool BuildDistances();
+	void FindPath(unsigned int start_idx, unsigned int end_idx, IndexVec &path);
+	unsigned int FindCellPath(const Vector2 &from, const Vector2 &to, std::vector<Vector2> *cells = NULL);
+	Rect GetBounds() const;
+	const Raster& Rasterize();
+	void RenderRaster(Raster &raster) const;
+	void Print();
+	unsigned int GetTileCount() const { return m_cur_tile_count; }
+	const ArrangeStore& GetArranges() const { return m_arranges; }
+	const LineVec& GetLines() const { return m_lines; }
+	const RoomGraph& GetRoomGraph() const { return m_adj_list; }
+	unsigned long long GetLayoutHash() const;
+	bool Save(const char *path) const;	// see dungeonfile.hpp, read back with DungeonView
+	bool Encode(CompactLayout &layout) const;
+	bool Decode(const CompactLayout &layout);
+	size_t GetMemoryUsage() const;
+	const GenStats& GetStats() const { return m_stats; }
+	void ResetStats() { m_stats.Reset(); }
+	friend bool BenchScale();
+	friend void BenchPlacement();
+	friend void BenchLocate();
+	friend bool BenchPaths(unsigned int queries);
+};
+
+// a valid catalog has 2 door tiles, so the default mix always has link tiles in it
+Graph::Graph(const TileCatalogPtr &catalog) : m_cur_tile_count(0), m_rolled_back(0), m_attempts(0), m_corridor_length(MaxCorridorLength)
+{
+	Seed((unsigned long long)time(NULL));
+	assert(catalog);
+	SetCatalog(catalog);
+}
+
+Graph::~Graph()
+{
+	m_arranges.Clear();
+	m_open_doors.clear();
+}
+
+bool HasLinkTiles(const TileMix &mix, const TileCatalog &catalog)
+{
+	bool any = false;
+	for (unsigned int i = 0; i < MaxDoorCount; ++i) {
+		any = any || (mix.door_shares[i] > 0.0 && !catalog.GetBucket(i).empty());
+	}
+	return any;
+}
+
+// generates from "catalog" from now on and drops the layout, which points at the old tiles. The mix
+// stays, false when it leaves no link tile in the catalog
+bool Graph::SetCatalog(const TileCatalogPtr &catalog)
+{
+	if (!catalog || !HasLinkTiles(m_mix, *catalog)) {
+		return false;
+	}
+	Reset();
+	m_catalog = catalog;
+	m_frontier.SetTiles(catalog->GetTileCount(), catalog->GetSlotCount());
+	BuildTileTables();
+	return true;
+}
+
+// replaces the tiles with the "*.tile" definitions in "dir", see TileCatalog::Load. On false the current tiles stay
+bool Graph::LoadTiles(const char *dir, const char *cache_path)
+{
+	TileCatalogPtr catalog = TileCatalog::Load(dir, cache_path);
+	return catalog && SetCatalog(catalog);
+}
+
+// false when the mix leaves no link tile, the tiles keep the previous mix then
+bool Graph::SetTileMix(const TileMix &mix)
+{
+	for (unsigned int i = 0; i < MaxDoorCount; ++i) {
+		if (mix.door_shares[i] < 0.0) {
+			return false;
+		}
+	}
+	if (!HasLinkTiles(mix, *m_catalog)) {
+		return false;
+	}
+	m_mix = mix;
+	BuildTileTables();
+	return true;
+}
+
+void Graph::BuildTileTables()
+{
+	std::vector<double> link_weights, end_weights, weights;
+	m_link_tiles.clear();
+	m_end_tiles.clear();
+	for (unsigned int b = 0; b < MaxDoorCount; ++b) {
+		const TileVec &tiles = m_catalog->GetBucket(b);
+		if (tiles.empty()) {
+			continue;
+		}
+		double mean_area = 0.0, sum = 0.0;
+		for (unsigned int t = 0; t < tiles.size(); ++t) {
+			mean_area += tiles[t]->m_height * tiles[t]->m_width;
+		}
+		mean_area /= tiles.size();
+		weights.resize(tiles.size());
+		for (unsigned int t = 0; t < tiles.size(); ++t) {
+			weights[t] = tiles[t]->m_weight * pow(tiles[t]->m_height * tiles[t]->m_width / mean_area, m_mix.area_power);
+			sum += weights[t];
+		}
+		for (unsigned int t = 0; t < tiles.size(); ++t) {
+			if (b == 0) {
+				m_end_tiles.push_back(tiles[t]);
+				end_weights.push_back(weights[t] / sum);
+			}
+			if (m_mix.door_shares[b] > 0.0) {
+				m_link_tiles.push_back(tiles[t]);
+				link_weights.push_back(m_mix.door_shares[b] * weights[t] / sum);
+			}
+		}
+	}
+	m_link_table.Build(link_weights);
+	m_end_table.Build(end_weights);
+}
+
+void Graph::Reset()
+{
+	 m_cur_tile_count = 0;
+	 m_arranges.Clear();
+	 m_placements.clear();
+	 m_spatial.Clear();
+	 m_occupancy.Clear();
+	 m_open_doors.clear();
+	 m_frontier.Clear();
+	 m_lines.clear();
+	 m_adj_list.Clear();
+	 m_distances.Clear();
+	 m_navigator.Clear();
+}
+
+// shorter corridors pack the rooms tighter but leave fewer ways to place each one
+bool Graph::SetCorridorLength(unsigned int length)
+{
+	if (length < 1 || length > MaxCorridorLength) {
+		return false;
+	}
+	Reset();
+	m_corridor_length = length;
+	return true;
+}
+
+// after Seed(seed), RandomGen and GenExact produce the same dungeon on every run
+void Graph::Seed(unsigned long long seed)
+{
+	m_seed = seed;
+	m_random.Seed(seed);
+}
+
+unsigned int Graph::FindArrange(const Vector2 &coord)
+{
+	STATS_TIMER(door_ns);
+	// Contain() accepts the row/column just past the rect, so look one cell back as well,
+	// and keep the lowest index to match the order of a linear scan
+	unsigned int found = InvalidIndex;
+	const ArrangeStore &arranges = m_arranges;
+	m_spatial.Query(Rect(coord.x - 1, coord.y - 1, 2, 2), [&](unsigned int i) {
+		if (i < found && arranges.Contain(i, coord)) {
+			found = i;
+		}
+		return true;
+	});
+	return found;
+}
+
+Rect Graph::GetTileRect(const Tile *tile, const Vector2 &coord, LocateMode loca_mode) const
+{
+	const TileVariant &variant = tile->m_variants[loca_mode];
+	return Rect(coord.x + variant.m_offset.x, coord.y + variant.m_offset.y, variant.m_height, variant.m_width);
+}
+
+bool Graph::CheckTile(const Tile *tile, const Vector2 &coord, LocateMode loca_mode) const
+{
+	STATS_TIMER(overlap_ns);
+	STATS_ADD(overlap_tests, 1);
+	Rect rect = GetTileRect(tile, coord, loca_mode);
+	if (!InBounds(rect.x, rect.y, rect.h, rect.w)) {
+		STATS_ADD(overlap_rejects, 1);
+		return false;
+	}
+	const TileVariant &variant = tile->m_variants[loca_mode];
+	bool ok = m_occupancy.Test(rect.x, rect.y, variant.m_height, variant.m_masks, 0);
+	STATS_ADD(overlap_rejects, ok ? 0 : 1);
+	return ok;
+}
+
+// the corridor between the door cells "start" and "end" must not cross a tile or another corridor
+bool Graph::CheckCorridor(const Vector2 &start, const Vector2 &end) const
+{
+	STATS_TIMER(overlap_ns);
+	STATS_ADD(corridor_tests, 1);
+	Rect rect;
+	if (!GetCorridorRect(start, end, rect)) {
+		return true;
+	}
+	bool ok = m_occupancy.TestRect(rect);
+	STATS_ADD(corridor_rejects, ok ? 0 : 1);
+	return ok;
+}
+
+// the origin of a Tile locate at the CENTER point of topleft
+void Graph::LinkTile(unsigned int arr_idx, const Tile *tile, const Vector2 &coord, LocateMode loca_mode)
+{
+	STATS_TIMER(door_ns);
+	STATS_ADD(tiles_placed, 1);
+	++m_cur_tile_count;
+	Arrange arrange;
+	arrange.m_pivot = coord;
+	arrange.m_rect = GetTileRect(tile, coord, loca_mode);
+	arrange.m_tile = tile;
+	arrange.m_locate = loca_mode;
+	m_arranges.Push(arrange);
+	m_spatial.Insert(arrange.m_rect, m_arranges.Size() - 1);
+	m_occupancy.Set(arrange.m_rect.x, arrange.m_rect.y, arrange.m_rect.h, tile->m_variants[loca_mode].m_masks);
+	if (m_placements.size() < m_arranges.Size()) {
+		// a root, PlaceTile records the others
+		Placement placement;
+		placement.src_door_idx = InvalidIndex;
+		m_placements.push_back(placement);
+	}
+
+	if (arr_idx != InvalidIndex) {
+		// add to adjacency list
+		unsigned int new_vertex = m_arranges.Size() - 1;
+		m_adj_list.AddEdge(arr_idx, new_vertex);
+	}
+}
+
+void Graph::AddDoors(const Tile *tile, const Vector2 &coord, LocateMode loca_mode, unsigned int exclude_door_idx)
+{
+	STATS_TIMER(door_ns);
+	const Door *doors = tile->m_variants[loca_mode].m_doors;
+	for (unsigned int i = 0; i < tile->m_door_count; ++i) {
+		if (i == exclude_door_idx) {
+			continue;
+		}
+		Door door;
+		door.direction = doors[i].direction;
+		door.locate = coord + doors[i].locate;
+		m_open_doors.push_back(door);
+		m_frontier.PushDoor();
+	}
+}
+
+void Graph::DelDoor(unsigned int idx)
+{
+	STATS_TIMER(door_ns);
+	if (idx != InvalidIndex) {
+		m_open_doors[idx] = *m_open_doors.rbegin();
+		m_open_doors.pop_back();
+		m_frontier.RemoveDoor(idx);
+	}
+}
+
+// links "tile" to the open door "src_door_idx" through a corridor ending at "door_pos",
+// the caller has checked that it fits
+void Graph::PlaceTile(unsigned int src_door_idx, const Tile *tile, unsigned int dst_door_idx, const Vector2 &door_pos,
+					  const Vector2 &coord, LocateMode loca_mode)
+{
+	Placement placement;
+	placement.src_door = m_open_doors[src_door_idx];
+	placement.src_door_idx = src_door_idx;
+	m_placements.push_back(placement);
+
+	unsigned int arr_idx = FindArrange(placement.src_door.locate);
+	AddLink(placement.src_door.locate, door_pos);
+	Rect corridor;
+	if (GetCorridorRect(placement.src_door.locate, door_pos, corridor)) {
+		m_occupancy.SetRect(corridor);
+	}
+	DelDoor(src_door_idx);
+	AddDoors(tile, coord, loca_mode, dst_door_idx);
+	LinkTile(arr_idx, tile, coord, loca_mode);
+}
+
+// takes back the last "count" PlaceTile calls, newest first, leaving the open doors exactly
+// as they were before them. Call RoomGraph::Compact again afterwards
+void Graph::RemoveTiles(unsigned int count)
+{
+	STATS_TIMER(door_ns);
+	STATS_ADD(rolled_back, count);
+	const unsigned int mark = m_arranges.GetMark() - count;
+	for (unsigned int n = 0; n < count; ++n) {
+		unsigned int idx = mark + count - 1 - n;
+		const Placement &placement = m_placements[idx];
+		assert(placement.src_door_idx != InvalidIndex);
+		// AddDoors appended every door but the linked one, DelDoor moved the last door into the hole
+		for (unsigned int k = 1; k < m_arranges.GetTile(idx)->m_door_count; ++k) {
+			m_open_doors.pop_back();
+			m_frontier.PopDoor();
+		}
+		if (placement.src_door_idx < m_open_doors.size()) {
+			m_open_doors.push_back(m_open_doors[placement.src_door_idx]);
+			m_open_doors[placement.src_door_idx] = placement.src_door;
+		}
+		else{
+			m_open_doors.push_back(placement.src_door);
+		}
+		m_frontier.InsertDoor(placement.src_door_idx);
+
+		Rect rect = m_arranges.GetRect(idx), corridor;
+		m_occupancy.Reset(rect.x, rect.y, rect.h, m_arranges.GetTile(idx)->m_variants[m_arranges.GetLocate(idx)].m_masks);
+		if (GetCorridorRect(m_lines.back().start, m_lines.back().end, corridor)) {
+			m_occupancy.ResetRect(corridor);
+		}
+
+		// the space the tile and its corridor freed may fit tiles at doors within reach of it
+		const int reach = MaxCorridorLength * 2 + MaxTileSize;
+		Rect reach_rect(rect.x - reach, rect.y - reach, rect.h + reach * 2, rect.w + reach * 2);
+		for (unsigned int d = 0; d < m_open_doors.size(); ++d) {
+			if (reach_rect.Contain(m_open_doors[d].locate)) {
+				m_frontier.Revive(d);
+			}
+		}
+		m_spatial.RemoveLast(rect);
+		m_placements.pop_back();
+		m_adj_list.PopEdge();
+		m_lines.pop_back();
+		--m_cur_tile_count;
+	}
+	m_arranges.Rewind(mark);
+}
+
+void Graph::AddLink(const Vector2 &start, const Vector2 &end)
+{
+	Line line;
+	line.start = start;
+	line.end = end;
+	m_lines.push_back(line);
+}
+
+// the tiles are drawn by the TileMix. A draw the DoorFrontier knows cannot fit at the door in any
+// orientation and corridor length is drawn again, up to MaxTilePicks times
+const Tile* Graph::ChooseEndTile(unsigned int door_idx)
+{
+	const Tile *tile = m_end_tiles[m_end_table.Sample(m_random)];
+	for (unsigned int i = 1; i < MaxTilePicks && !m_frontier.IsLive(door_idx, tile->m_frontier_id); ++i) {
+		STATS_ADD(dead_picks, 1);
+		tile = m_end_tiles[m_end_table.Sample(m_random)];
+	}
+	return tile;
+}
+
+const Tile* Graph::ChooseLinkTile(unsigned int src_door_idx)
+{
+	const Tile *tile = m_link_tiles[m_link_table.Sample(m_random)];
+	for (unsigned int i = 1; i < MaxTilePicks && src_door_idx != InvalidIndex
+		&& !m_frontier.IsLive(src_door_idx, tile->m_frontier_id); ++i) {
+		STATS_ADD(dead_picks, 1);
+		tile = m_link_tiles[m_link_table.Sample(m_random)];
+	}
+	return tile;
+}
+
+// draws a corridor length and locate choice, returns them as a DoorFrontier combination
+unsigned int Graph::DrawCombo()
+{
+	STATS_ADD(candidates, 1);
+	unsigned int len = m_random.GetRand(1, m_corridor_length);
+	unsigned int choice = m_random.GetRand(0, 1);
+	return (len - 1) * 2 + choice;
+}
+
+// locate "tile" so that its door "dst_door_idx" meets "src_door" through a corridor of "len" cells,
+// "choice" picks one of the two locate modes that turn the door to face the source door
+void Graph::LocateNewTile(const Door *src_door, const Tile *tile, unsigned int dst_door_idx, unsigned int len, unsigned int choice,
+						  Vector2 &door_pos, Vector2 &coord, LocateMode &loca_mode) const
+{
+	door_pos.Set(src_door->locate.x + DoorSteps[src_door->direction][0] * (int)len,
+		src_door->locate.y + DoorSteps[src_door->direction][1] * (int)len);
+	loca_mode = FacingLocates[src_door->direction][tile->GetDoor(dst_door_idx).direction][choice];
+	coord = door_pos - tile->m_variants[loca_mode].m_doors[dst_door_idx].locate;
+}
+
+// LocateNewTile, CheckTile and CheckCorridor in one, for a source door facing S and a tile located by M,
+// so the variant, the corridor axis and the step are constants
+template <DoorDirection S, LocateMode M>
+bool Graph::FitCandidate(const Door &src_door, const Tile *tile, unsigned int dst_door_idx, unsigned int len,
+						 Vector2 &door_pos, Vector2 &coord) const
+{
+	const TileVariant &variant = tile->m_variants[M];
+	door_pos.Set(src_door.locate.x + DoorSteps[S][0] * (int)len, src_door.locate.y + DoorSteps[S][1] * (int)len);
+	coord = door_pos - variant.m_doors[dst_door_idx].locate;
+
+	STATS_TIMER(overlap_ns);
+	STATS_ADD(overlap_tests, 1);
+	const int x = coord.x + variant.m_offset.x, y = coord.y + variant.m_offset.y;
+	if (!InBounds(x, y, variant.m_height, variant.m_width)) {
+		STATS_ADD(overlap_rejects, 1);
+		return false;
+	}
+	if (!m_occupancy.Test(x, y, variant.m_height, variant.m_masks, 0)) {
+		STATS_ADD(overlap_rejects, 1);
+		return false;
+	}
+
+	// the corridor cells lie between the two doors, along S
+	STATS_ADD(corridor_tests, 1);
+	const int run = (int)len - 1;
+	if (run <= 0) {
+		return true;
+	}
+	bool ok = m_occupancy.TestRect(GetStepCorridor(src_door.locate, S, run));
+	STATS_ADD(corridor_rejects, ok ? 0 : 1);
+	return ok;
+}
+
+#define CANDIDATE_CASES(S) \
+	case S * LocateModeCount + Rotate0: return FitCandidate<S, Rotate0>(*src_door, tile, dst_door_idx, len, door_pos, coord); \
+	case S * LocateModeCount + Rotate90: return FitCandidate<S, Rotate90>(*src_door, tile, dst_door_idx, len, door_pos, coord); \
+	case S * LocateModeCount + Rotate180: return FitCandidate<S, Rotate180>(*src_door, tile, dst_door_idx, len, door_pos, coord); \
+	case S * LocateModeCount + Rotate270: return FitCandidate<S, Rotate270>(*src_door, tile, dst_door_idx, len, door_pos, coord); \
+	case S * LocateModeCount + HoriMirror: return FitCandidate<S, HoriMirror>(*src_door, tile, dst_door_idx, len, door_pos, coord); \
+	case S * LocateModeCount + VertMirror: return FitCandidate<S, VertMirror>(*src_door, tile, dst_door_idx, len, door_pos, coord);
+
+// locates "tile" for the DoorFrontier combination "combo" and tests that it and its corridor fit,
+// the only runtime branch on the orientation is the one switch that picks the FitCandidate instance
+bool Graph::FitNewTile(const Door *src_door, const Tile *tile, unsigned int dst_door_idx, unsigned int combo,
+					   Vector2 &door_pos, Vector2 &coord, LocateMode &loca_mode) const
+{
+	STATS_TIMER(candidate_ns);
+	loca_mode = FacingLocates[src_door->direction][tile->GetDoor(dst_door_idx).direction][combo % 2];
+	const unsigned int len = combo / 2 + 1;
+	switch (src_door->direction * LocateModeCount + loca_mode) {
+	CANDIDATE_CASES(DoorUp)
+	CANDIDATE_CASES(DoorDown)
+	CANDIDATE_CASES(DoorLeft)
+	CANDIDATE_CASES(DoorRight)
+	default:
+		assert(0);
+		return false;
+	}
+}
+
+#undef CANDIDATE_CASES
+
+// builds every combination of "tile" at the open door "door" that is not known to be blocked, then
+// tests them all against a window of the occupancy around the door. Returns how many fit
+unsigned int Graph::TestDoorBatch(unsigned int door, const Tile *tile, CandidateBatch &batch)
+{
+	STATS_TIMER(candidate_ns);
+	const Door &src_door = m_open_doors[door];
+	const unsigned int combo_count = m_corridor_length * 2;
+	batch.count = 0;
+	for (unsigned int k = 0; k < tile->m_door_count; ++k) {
+		const unsigned int slot = tile->m_frontier_slot + k;
+		for (unsigned int combo = 0; combo < combo_count; ++combo) {
+			if (m_frontier.IsBlocked(door, slot, combo)) {
+				continue;
+			}
+			const LocateMode loca_mode = FacingLocates[src_door.direction][tile->GetDoor(k).direction][combo % 2];
+			const TileVariant &variant = tile->m_variants[loca_mode];
+			const int len = combo / 2 + 1;
+			const unsigned int n = batch.count++;
+			batch.dst_doors[n] = k;
+			batch.combos[n] = combo;
+			batch.locates[n] = loca_mode;
+			batch.xs[n] = src_door.locate.x + DoorSteps[src_door.direction][0] * len - variant.m_doors[k].locate.x + variant.m_offset.x;
+			batch.ys[n] = src_door.locate.y + DoorSteps[src_door.direction][1] * len - variant.m_doors[k].locate.y + variant.m_offset.y;
+		}
+	}
+	STATS_ADD(fallback_candidates, batch.count);
+	if (batch.count == 0) {
+		return 0;
+	}
+
+	STATS_TIMER(overlap_ns);
+	STATS_ADD(overlap_tests, batch.count);
+	m_window.Load(m_occupancy, src_door.locate);
+	unsigned int fit_count = 0;
+	for (unsigned int n = 0; n < batch.count; ++n) {
+		const TileVariant &variant = tile->m_variants[batch.locates[n]];
+		bool fit = InBounds(batch.xs[n], batch.ys[n], variant.m_height, variant.m_width)
+			&& m_window.Test(batch.xs[n], batch.ys[n], variant.m_height, variant.m_masks);
+		STATS_ADD(overlap_rejects, fit ? 0 : 1);
+		STATS_ADD(corridor_tests, fit ? 1 : 0);
+		const int run = batch.combos[n] / 2;
+		if (fit && run > 0) {
+			fit = m_window.TestRect(GetStepCorridor(src_door.locate, src_door.direction, run));
+			STATS_ADD(corridor_rejects, fit ? 0 : 1);
+		}
+		batch.fits[n] = fit;
+		fit_count += fit ? 1 : 0;
+	}
+	return fit_count;
+}
+
+void Graph::PlaceBatchCandidate(unsigned int door, const Tile *tile, const CandidateBatch &batch, unsigned int n)
+{
+	const Door &src_door = m_open_doors[door];
+	const LocateMode loca_mode = (LocateMode)batch.locates[n];
+	const int len = batch.combos[n] / 2 + 1;
+	Vector2 door_pos(src_door.locate.x + DoorSteps[src_door.direction][0] * len, src_door.locate.y + DoorSteps[src_door.direction][1] * len);
+	Vector2 coord = door_pos - tile->m_variants[loca_mode].m_doors[batch.dst_doors[n]].locate;
+	PlaceTile(door, tile, batch.dst_doors[n], door_pos, coord, loca_mode);
+}
+
+bool Graph::RandomGen(unsigned int tile_count)
+{
+	assert(tile_count > 1);
+	STATS_TIMER(gen_ns);
+	STATS_ADD(gen_attempts, 1);
+	// size everything for this dungeon up front, once a Graph has generated a dungeon
+	// this large, generating again never grows a buffer
+	m_arranges.Reserve(tile_count);
+	m_placements.reserve(tile_count);
+	m_open_doors.reserve(tile_count * MaxDoorCount);
+	m_frontier.Reserve(tile_count * MaxDoorCount);
+	m_lines.reserve(tile_count);
+	m_adj_list.Reserve(tile_count);
+
+	// world coordinates are signed and the root is placed at the origin
+	Vector2 coord(0, 0);
+	LocateMode loca_mode = Rotate0;
+	const Tile *tile = ChooseLinkTile();
+	// the first tile as the root
+	AddDoors(tile, coord, loca_mode, InvalidIndex);
+	LinkTile(InvalidIndex, tile, coord, loca_mode);
+
+	GrowTiles(tile_count);
+	CloseDoors(tile_count);
+
+	m_adj_list.Compact(m_arranges.Size());
+	STATS_ADD(gen_failures, m_cur_tile_count == tile_count ? 0 : 1);
+	return m_cur_tile_count == tile_count;
+}
+
+// link random tiles to the open doors until there are "tile_count" tiles or no doors left
+void Graph::GrowTiles(unsigned int tile_count)
+{
+	Vector2 door_pos(0, 0), coord(0, 0);
+	LocateMode loca_mode = Rotate0;
+	const Tile *tile = NULL;
+	// random link last (tile_count - 1) tile
+	for(unsigned int i = m_cur_tile_count; i < tile_count && !m_open_doors.empty(); ++i) {
+		unsigned int src_door_idx = m_random.GetRand(0, m_open_doors.size() - 1);	
+		tile = ChooseLinkTile(src_door_idx);
+		unsigned int dst_door_idx = m_random.GetRand(0, tile->m_door_count - 1);
+		unsigned int combo = DrawCombo();
+		unsigned int slot = tile->m_frontier_slot + dst_door_idx;
+		if (!m_frontier.IsBlocked(src_door_idx, slot, combo)
+			&& FitNewTile(&m_open_doors[src_door_idx], tile, dst_door_idx, combo, door_pos, coord, loca_mode)) {
+			PlaceTile(src_door_idx, tile, dst_door_idx, door_pos, coord, loca_mode);
+		}
+		else{
+			m_frontier.Block(src_door_idx, slot, combo);
+			STATS_ADD(fallback_scans, 1);
+			// test every combination not known to be blocked at the doors the tile may still fit, a door
+			// at a time, and link one of those that fit at random. A door where none fits is dead for this
+			// tile, so over a whole generation each combination fails at most once. Doors go newest first,
+			// which stands in for the doors with the most free space: newer doors sit on the rim of the
+			// layout. Ranking the newest few by a free cell count of the occupancy tested fewer
+			// candidates but grew sprawling layouts that took longer to finish
+			bool linked = false;
+			const IndexVec &live = m_frontier.GetLive(tile->m_frontier_id);
+			while (!live.empty() && !linked) {
+				unsigned int d = live.back();
+				unsigned int fit_count = TestDoorBatch(d, tile, m_batch);
+				unsigned int pick = fit_count > 0 ? m_random.GetRand(0, fit_count - 1) : 0;
+				for (unsigned int n = 0; n < m_batch.count; ++n) {
+					if (!m_batch.fits[n]) {
+						m_frontier.Block(d, tile->m_frontier_slot + m_batch.dst_doors[n], m_batch.combos[n]);
+					}
+					else if (pick-- == 0) {
+						// the blocks of the candidates after it would point at moved doors
+						PlaceBatchCandidate(d, tile, m_batch, n);
+						linked = true;
+						break;
+					}
+				}
+				if (!linked) {
+					m_frontier.Kill(d, tile->m_frontier_id);
+				}
+			}
+			STATS_ADD(fallback_failures, linked ? 0 : 1);
+		}
+	}
+}
+
+// link end tile to the door or just close it
+void Graph::CloseDoors(unsigned int tile_count)
+{
+	STATS_TIMER(close_ns);
+	Vector2 door_pos(0, 0), coord(0, 0);
+	LocateMode loca_mode = Rotate0;
+	const Tile *tile = NULL;
+	for (unsigned int i = 0; i < m_open_doors.size(); ++i) {
+		tile = ChooseEndTile(i);
+		unsigned int combo = DrawCombo();
+		bool ok = !m_frontier.IsBlocked(i, tile->m_frontier_slot, combo)
+			&& FitNewTile(&m_open_doors[i], tile, 0, combo, door_pos, coord, loca_mode);
+		if (!ok) {
+			m_frontier.Block(i, tile->m_frontier_slot, combo);
+		}
+		STATS_ADD(end_tile_tries, 1);
+		STATS_ADD(end_tile_fails, ok ? 0 : 1);
+		if (ok && m_cur_tile_count < tile_count) {
+			PlaceTile(i, tile, 0, door_pos, coord, loca_mode);
+		}
+	}
+}
+
+bool Graph::RandomGen(unsigned int tile_count, unsigned long long seed)
+{
+	Seed(seed);
+	return RandomGen(tile_count);
+}
+
+// generates the part of an open world that lies inside "bounds". The root tile sits at the
+// center and four straight corridors run from it to the middle of each border, so the
+// chunk joins its neighbours whatever they contain. Every chunk is a dungeon of its own:
+// no door and no room graph edge crosses a border, the spines are the only way across.
+// Returns the number of tiles placed
+unsigned int Graph::GenChunk(const Rect &bounds, unsigned int tile_count, unsigned long long seed)
+{
+	Reset();
+	Seed(seed);
+	m_bounds = bounds;
+	m_arranges.Reserve(tile_count);
+	m_placements.reserve(tile_count);
+	m_open_doors.reserve(tile_count * MaxDoorCount);
+	m_frontier.Reserve(tile_count * MaxDoorCount);
+	m_lines.reserve(tile_count + 4);
+	m_adj_list.Reserve(tile_count);
+
+	Vector2 center(bounds.x + bounds.h / 2, bounds.y + bounds.w / 2);
+	const Tile *tile = ChooseLinkTile();
+	const TileVariant &variant = tile->m_variants[Rotate0];
+	Vector2 coord(center.x - variant.m_height / 2, center.y - variant.m_width / 2);
+	AddDoors(tile, coord, Rotate0, InvalidIndex);
+	LinkTile(InvalidIndex, tile, coord, Rotate0);
+
+	// the corridors end on the root wall, which Rasterize turns into a door, but what they
+	// occupy stops a cell short of it since the root owns every cell of its rect
+	Rect root = m_arranges.GetRect(0);
+	Line spines[4];
+	spines[0].start.Set(bounds.x, center.y);
+	spines[0].end.Set(root.x, center.y);
+	spines[1].start.Set(root.x + root.h - 1, center.y);
+	spines[1].end.Set(bounds.x + bounds.h - 1, center.y);
+	spines[2].start.Set(center.x, bounds.y);
+	spines[2].end.Set(center.x, root.y);
+	spines[3].start.Set(center.x, root.y + root.w - 1);
+	spines[3].end.Set(center.x, bounds.y + bounds.w - 1);
+	Rect spine_cells[4] = {
+		Rect(bounds.x, center.y, root.x - bounds.x, 1),
+		Rect(root.x + root.h, center.y, bounds.x + bounds.h - root.x - root.h, 1),
+		Rect(center.x, bounds.y, 1, root.y - bounds.y),
+		Rect(center.x, root.y + root.w, 1, bounds.y + bounds.w - root.y - root.w) };
+	for (unsigned int i = 0; i < 4; ++i) {
+		AddLink(spines[i].start, spines[i].end);
+		if (spine_cells[i].h > 0 && spine_cells[i].w > 0) {
+			m_occupancy.SetRect(spine_cells[i]);
+		}
+	}
+
+	GrowTiles(tile_count);
+	CloseDoors(tile_count);
+	m_adj_list.Compact(m_arranges.Size());
+
+	m_bounds.Set(0, 0, 0, 0);
+	return m_cur_tile_count;
+}
+
+// a layout that misses "tile_count" is repaired instead of thrown away: each round takes back
+// the newest tiles, then grows and closes again from the doors that freed up. The first repair
+// takes back one tile and each further one twice as many, until that would be the whole layout
+// and it starts over at one. The default mix needs a few rounds, the dead end heavy mix of
+// RunSweep up to about 40 at 200 tiles and 100 at 400, hence DefaultExactRounds
+bool Graph::GenExact(unsigned int tile_count, unsigned int max_rounds)
+{
+	Reset();
+	m_rolled_back = 0;
+	m_attempts = max_rounds > 0 ? 1 : 0;
+	bool ok = max_rounds > 0 && RandomGen(tile_count);
+	unsigned int undo = 1;
+	for (unsigned int i = 1; i < max_rounds && (!ok); ++i) {
+		STATS_ADD(repair_rounds, 1);
+		unsigned int count = std::min(undo, m_cur_tile_count - 1);
+		RemoveTiles(count);
+		m_rolled_back += count;
+		++m_attempts;
+		GrowTiles(tile_count);
+		CloseDoors(tile_count);
+		m_adj_list.Compact(m_arranges.Size());
+		ok = m_cur_tile_count == tile_count;
+		undo = undo * 2 < m_cur_tile_count ? undo * 2 : 1;
+	}
+	STATS_ADD(exact_calls, 1);
+	STATS_ADD(exact_successes, ok ? 1 : 0);
+	return ok;
+}
+
+// all-pairs hop distances for the current layout, so FindPath no longer searches.
+// Worth it once a layout is queried more than a few dozen times; false when the
+// layout has more than MaxDistanceRooms rooms
+bool Graph::BuildDistances()
+{
+	if (m_arranges.Size() > MaxDistanceRooms) {
+		return false;
+	}
+	m_distances.Build(m_adj_list);
+	return true;
+}
+
+// steps of a shortest walk between two floor or door cells of rooms, INF when there is none or
+// either cell is outside the rooms. "cells" gets the walk, both ends included, unless it is NULL
+unsigned int Graph::FindCellPath(const Vector2 &from, const Vector2 &to, std::vector<Vector2> *cells)
+{
+	if (!m_navigator.IsBuilt()) {
+		m_navigator.Build(m_arranges, m_spatial, m_lines);
+	}
+	unsigned int room_from = m_navigator.FindRoom(from), room_to = m_navigator.FindRoom(to);
+	if (room_from == InvalidIndex || room_to == InvalidIndex) {
+		return INF;
+	}
+	FindPath(room_from, room_to, m_cell_rooms);
+	return m_navigator.FindPath(from, to, m_cell_rooms, cells);
+}
+
+// "path" gets the rooms from start_idx to end_idx, both included, or is empty when there is no path
+void Graph::FindPath(unsigned int start_idx, unsigned int end_idx, IndexVec &path)
+{
+	const unsigned int nv = m_arranges.Size();
+	if (m_distances.GetRoomCount() == nv && nv > 0) {
+		m_distances.GetPath(m_adj_list, start_idx, end_idx, path);
+		return;
+	}
+
+	m_path_dist.assign(nv, INF);
+	m_path_prev.resize(nv);
+	m_path_queue.resize(nv);
+	unsigned int *d = m_path_dist.data(); // d[i] Դڵ㵽ڵi̾
+	unsigned int *p = m_path_prev.data(); // p[i]: Դڵ㵽ڵi·ϣڵiǰһڵ
+	unsigned int *queue = m_path_queue.data();	// a room is queued once, when d is set
+
+	unsigned int head = 0, tail = 0;
+	d[start_idx] = 0;
+	queue[tail++] = start_idx;
+	while (head < tail && d[end_idx] == INF) {
+		unsigned int u_idx = queue[head++];
+		const unsigned int *adj = m_adj_list.GetNeighbors(u_idx);
+		for (unsigned int i = 0; i < m_adj_list.GetDegree(u_idx); ++i) {
+			unsigned int v_idx = adj[i];
+			if (d[v_idx] == INF) {
+				d[v_idx] = d[u_idx] + 1;
+				p[v_idx] = u_idx;
+				queue[tail++] = v_idx;
+			}
+		}
+	}
+
+	if (d[end_idx] == INF) {
+		path.clear();
+		return;
+	}
+	// the path has d[end_idx] + 1 rooms, fill it from the back
+	path.resize(d[end_idx] + 1);
+	unsigned int idx = end_idx;
+	for (unsigned int k = d[end_idx]; k > 0; --k, idx = p[idx]) {
+		path[k] = idx;
+	}
+	path[0] = start_idx;
+}
+
+// the rect the rooms cover, h and w are 0 without rooms
+Rect Graph::GetBounds() const
+{
+	if (m_arranges.Size() == 0) {
+		return Rect(0, 0, 0, 0);
+	}
+	int left = INT_MAX, right = INT_MIN, top = INT_MAX, bottom = INT_MIN;
+	for (unsigned int i = 0; i < m_arranges.Size(); ++i) {
+		Rect rect = m_arranges.GetRect(i);
+		top = std::min<int>(top, rect.x);
+		bottom = std::max<int>(bottom, rect.x + rect.h);
+		left = std::min<int>(left, rect.y);
+		right = std::max<int>(right, rect.y + rect.w);
+	}
+	return Rect(top, left, bottom - top + 1, right - left + 1);
+}
+
+// renders the layout into m_raster, rooms are copied from their located tile rows
+// and corridors are filled as runs, the buffer is reused by the next call
+const Raster& Graph::Rasterize()
+{
+	Rect bounds = GetBounds();
+	m_raster.Reset(bounds.x, bounds.y, bounds.h, bounds.w);
+	RenderRaster(m_raster);
+	return m_raster;
+}
+
+// draws whatever part of the rooms and corridors lies inside the window of "raster", so a map
+// can also be drawn a band at a time. Cells no room covers are left as they are
+void Graph::RenderRaster(Raster &raster) const
+{
+	const Rect window(raster.GetTop(), raster.GetLeft(), raster.GetHeight(), raster.GetWidth());
+	const int bottom = window.x + window.h, right = window.y + window.w;
+	for (unsigned int a = 0; a < m_arranges.Size(); ++a) {
+		if (!m_arranges.Intersect(a, window)) {
+			continue;
+		}
+		Rect rect = m_arranges.GetRect(a);
+		const TileVariant &variant = m_arranges.GetTile(a)->m_variants[m_arranges.GetLocate(a)];
+		int x0 = std::max(rect.x, window.x), x1 = std::min(rect.x + rect.h, bottom);
+		int y0 = std::max(rect.y, window.y), y1 = std::min(rect.y + rect.w, right);
+		for (int x = x0; x < x1; ++x) {
+			unsigned long long row = variant.m_grids[x - rect.x] >> ((y0 - rect.y) * 2);
+			char *cell = raster.GetCell(x, y0);
+			for (int y = y0; y < y1; ++y, row >>= 2) {
+				*cell++ = GridChar[row & 3];
+			}
+		}
+		if (raster.Contain(rect.x, rect.y)) {
+			*raster.GetCell(rect.x, rect.y) = 'A' + (a % 26);
+		}
+	}
+
+	for (unsigned int i = 0; i < m_lines.size(); ++i) {
+		const Line &line = m_lines[i];
+		if (line.start.x == line.end.x) {
+			int y0 = std::max(std::min(line.start.y, line.end.y), window.y);
+			int y1 = std::min(std::max(line.start.y, line.end.y) + 1, right);
+			if (line.start.x >= window.x && line.start.x < bottom && y0 < y1) {
+				memset(raster.GetCell(line.start.x, y0), GridChar[GridDoor], sizeof(char) * (y1 - y0));
+			}
+		}
+		else if (line.start.y == line.end.y) {
+			int x0 = std::max(std::min(line.start.x, line.end.x), window.x);
+			int x1 = std::min(std::max(line.start.x, line.end.x) + 1, bottom);
+			if (line.start.y >= window.y && line.start.y < right) {
+				for (int x = x0; x < x1; ++x) {
+					*raster.GetCell(x, line.start.y) = GridChar[GridDoor];
+				}
+			}
+		}
+	}
+}
+
+enum ExportFormat{
+	ExportAscii = 0,	// the map as Print shows it, column letters on top and a row number in front of every row
+	ExportPgm,	// binary graymap, one gray level per grid type
+	ExportPpm,	// binary pixmap, one color per grid type
+	ExportJson,	// rooms, corridors and the room graph, no cells
+	ExportFormatCount,
+};
+
+// writes a layout in one of the ExportFormat. Write renders the whole export into one buffer and
+// hands it to the stream with a single write. Stream renders the map a band of rows at a time and
+// writes whenever the buffer passes flush_size, so memory stays bounded however large the map is.
+// Both produce the same bytes. The buffers are kept, exporting again does not reallocate
+class MapExporter{
+	std::string m_buffer;
+	Raster m_band;
+	std::ostream *m_out;
+	size_t m_flush_size;	// 0 while the whole export is buffered
+	unsigned char m_grays[256];
+	unsigned char m_colors[256][3];
+private:
+	void Run(const Graph &graph, ExportFormat format, std::ostream &out, unsigned int band_rows, size_t flush_size, unsigned int scale);
+	void Flush(bool force);
+	void AppendMap(const Graph &graph, ExportFormat format, unsigned int band_rows, unsigned int scale);
+	void AppendBand(ExportFormat format, unsigned int first_row, unsigned int scale);
+	void AppendJson(const Graph &graph);
+public:
+	MapExporter();
+	void Write(const Graph &graph, ExportFormat format, std::ostream &out, unsigned int scale = 1);
+	void Stream(const Graph &graph, ExportFormat format, std::ostream &out, unsigned int band_rows = 64,
+		size_t flush_size = 1 << 20, unsigned int scale = 1);
+	size_t GetMemoryUsage() const { return m_buffer.capacity() + m_band.GetMemoryUsage(); }
+};
+
+MapExporter::MapExporter() : m_out(NULL), m_flush_size(0)
+{
+	// room labels and anything else unknown draw as walls
+	memset(m_grays, 96, sizeof(m_grays));
+	for (unsigned int c = 0; c < 256; ++c) {
+		m_colors[c][0] = 110;
+		m_colors[c][1] = 90;
+		m_colors[c][2] = 70;
+	}
+	const unsigned char grays[GridTypeCount] = { 0, 96, 230, 160 };
+	const unsigned char colors[GridTypeCount][3] = { { 0, 0, 0 }, { 110, 90, 70 }, { 230, 220, 190 }, { 200, 60, 40 } };
+	for (unsigned int t = 0; t < GridTypeCount; ++t) {
+		unsigned char c = (unsigned char)GridChar[t];
+		m_grays[c] = grays[t];
+		memcpy(m_colors[c], colors[t], 3);
+	}
+}
+
+void MapExporter::Write(const Graph &graph, ExportFormat format, std::ostream &out, unsigned int scale)
+{
+	Run(graph, format, out, graph.GetBounds().h, 0, scale);
+}
+
+void MapExporter::Stream(const Graph &graph, ExportFormat format, std::ostream &out, unsigned int band_rows,
+	size_t flush_size, unsigned int scale)
+{
+	Run(graph, format, out, std::max(band_rows, 1u), std::max<size_t>(flush_size, 1), scale);
+}
+
+void MapExporter::Run(const Graph &graph, ExportFormat format, std::ostream &out, unsigned int band_rows, size_t flush_size, unsigned int scale)
+{
+	m_out = &out;
+	m_flush_size = flush_size;
+	m_buffer.clear();
+	if (format == ExportJson) {
+		AppendJson(graph);
+	}
+	else {
+		AppendMap(graph, format, band_rows, std::max(scale, 1u));
+	}
+	Flush(true);
+	m_out = NULL;
+}
+
+void MapExporter::Flush(bool force)
+{
+	if (force || (m_flush_size > 0 && m_buffer.size() >= m_flush_size)) {
+		m_out->write(m_buffer.data(), m_buffer.size());
+		m_buffer.clear();
+	}
+}
+
+void MapExporter::AppendMap(const Graph &graph, ExportFormat format, unsigned int band_rows, unsigned int scale)
+{
+	const Rect bounds = graph.GetBounds();
+	const unsigned int h = bounds.h, w = bounds.w;
+	char text[64];
+	if (format == ExportAscii) {
+		if (m_flush_size == 0) {
+			m_buffer.reserve((size_t)(h + 1) * (w + 6));
+		}
+		m_buffer.append(5, ' ');
+		for (unsigned int i = 0; i < w; ++i) {
+			m_buffer.push_back('A' + (i % 26));
+		}
+		m_buffer.push_back('\n');
+	}
+	else {
+		snprintf(text, sizeof(text), "%s\n%u %u\n255\n", format == ExportPgm ? "P5" : "P6", w * scale, h * scale);
+		m_buffer.append(text);
+		if (m_flush_size == 0) {
+			m_buffer.reserve(m_buffer.size() + (size_t)h * w * scale * scale * (format == ExportPgm ? 1 : 3));
+		}
+	}
+
+	for (unsigned int first = 0; first < h; first += band_rows) {
+		m_band.Reset(bounds.x + first, bounds.y, std::min(band_rows, h - first), w);
+		graph.RenderRaster(m_band);
+		AppendBand(format, first, scale);
+	}
+}
+
+void MapExporter::AppendBand(ExportFormat format, unsigned int first_row, unsigned int scale)
+{
+	const unsigned int w = m_band.GetWidth();
+	const unsigned int channels = format == ExportPgm ? 1 : 3;
+	for (unsigned int i = 0; i < m_band.GetHeight(); ++i) {
+		const char *row = m_band.GetRow(i);
+		if (format == ExportAscii) {
+			char number[16];
+			snprintf(number, sizeof(number), "%5u", first_row + i);
+			m_buffer.append(number);
+			m_buffer.append(row, w);
+			m_buffer.push_back('\n');
+			Flush(false);
+			continue;
+		}
+		// one pixel row, repeated for the height of a cell
+		size_t start = m_buffer.size(), bytes = (size_t)w * scale * channels;
+		m_buffer.resize(start + bytes * scale);
+		unsigned char *dst = (unsigned char*)&m_buffer[start];
+		if (scale == 1 && channels == 1) {
+			for (unsigned int j = 0; j < w; ++j) {
+				dst[j] = m_grays[(unsigned char)row[j]];
+			}
+			Flush(false);
+			continue;
+		}
+		for (unsigned int j = 0; j < w; ++j) {
+			unsigned char c = (unsigned char)row[j];
+			for (unsigned int k = 0; k < scale; ++k, dst += channels) {
+				if (channels == 1) {
+					*dst = m_grays[c];
+				}
+				else {
+					memcpy(dst, m_colors[c], 3);
+				}
+			}
+		}
+		for (unsigned int k = 1; k < scale; ++k) {
+			memcpy(&m_buffer[start + bytes * k], &m_buffer[start], bytes);
+		}
+		Flush(false);
+	}
+}
+
+void MapExporter::AppendJson(const Graph &graph)
+{
+	const ArrangeStore &arranges = graph.GetArranges();
+	const LineVec &lines = graph.GetLines();
+	const RoomGraph &adj = graph.GetRoomGraph();
+	const Rect bounds = graph.GetBounds();
+	char text[256];
+	snprintf(text, sizeof(text), "{\n  \"version\": 1,\n  \"seed\": %llu,\n  \"bounds\": [%d, %d, %d, %d],\n  \"rooms\": [",
+		graph.GetSeed(), bounds.x, bounds.y, bounds.h, bounds.w);
+	m_buffer.append(text);
+	for (unsigned int i = 0; i < arranges.Size(); ++i) {
+		Arrange arrange = arranges[i];
+		snprintf(text, sizeof(text), "%s\n    {\"id\": %u, \"tile\": %u, \"locate\": %d, \"pivot\": [%d, %d], \"rect\": [%d, %d, %d, %d]}",
+			i > 0 ? "," : "", i, arrange.m_tile->GetTypeId(), (int)arrange.m_locate, arrange.m_pivot.x, arrange.m_pivot.y,
+			arrange.m_rect.x, arrange.m_rect.y, arrange.m_rect.h, arrange.m_rect.w);
+		m_buffer.append(text);
+		Flush(false);
+	}
+	m_buffer.append("\n  ],\n  \"corridors\": [");
+	for (unsigned int i = 0; i < lines.size(); ++i) {
+		snprintf(text, sizeof(text), "%s\n    [%d, %d, %d, %d]", i > 0 ? "," : "",
+			lines[i].start.x, lines[i].start.y, lines[i].end.x, lines[i].end.y);
+		m_buffer.append(text);
+		Flush(false);
+	}
+	// the room graph is compacted after every generation, a node count of 0 means it has no edges yet
+	m_buffer.append("\n  ],\n  \"adjacency\": [");
+	for (unsigned int i = 0; i < adj.GetNodeCount(); ++i) {
+		m_buffer.append(i > 0 ? ",\n    [" : "\n    [");
+		const unsigned int *neighbors = adj.GetNeighbors(i);
+		for (unsigned int k = 0; k < adj.GetDegree(i); ++k) {
+			snprintf(text, sizeof(text), k > 0 ? ", %u" : "%u", neighbors[k]);
+			m_buffer.append(text);
+		}
+		m_buffer.push_back(']');
+		Flush(false);
+	}
+	m_buffer.append("\n  ]\n}\n");
+}
+
+void Graph::Print()
+{
+	// the map goes out in one write
+	cout<<m_cur_tile_count<<'\n';
+	MapExporter exporter;
+	exporter.Write(*this, ExportAscii, cout);
+	cout<<'\n';
+
+	cout<<"adjacent matrix:"<<endl;
+
+	if (m_arranges.Size() <= 24) {
+		for (unsigned int i = 0; i < m_arranges.Size(); ++i) {
+			cout<<"Node "<<(char)('A'+ i)<<"->";
+			const unsigned int *adj = m_adj_list.GetNeighbors(i);
+			for (unsigned int j = 0; j < m_adj_list.GetDegree(i); ++j) {
+				cout<<(char)('A'+ adj[j]);
+				if (j + 1 < m_adj_list.GetDegree(i)) {
+					cout<<"->";
+				}
+				else {
+					cout<<endl;
+				}
+			}
+		}
+		cout<<endl;
+	}
+	else{
+		for (unsigned int i = 0; i < m_arranges.Size(); ++i) {
+			cout<<"Node "<<i<<"->";
+			const unsigned int *adj = m_adj_list.GetNeighbors(i);
+			for (unsigned int j = 0; j < m_adj_list.GetDegree(i); ++j) {
+				cout<<adj[j];
+				if (j + 1 < m_adj_list.GetDegree(i)) {
+					cout<<"->";
+				}
+				else {
+					cout<<endl;
+				}
+			}
+		}
+		cout<<endl;
+	}
+
+}
+
+// monotonic wall clock in milliseconds
+double GetTimeMs()
+{
+	typedef std::chrono::steady_clock Clock;
+	return std::chrono::duration<double, std::milli>(Clock::now().time_since_epoch()).count();
+}
+
+// the cost of one placement candidate (door lookup + overlap test) should stay flat
+// as the dungeon grows, the linear scan column shows what it cost before the broad-phase
+void BenchPlacement()
+{
+	Graph graph;
+	const unsigned int counts[] = { 25, 50, 100, 200, 400, 800 };
+	const unsigned int rounds = 50;
+	cout<<setw(12)<<"tile_count"<<setw(16)<<"ms/dungeon"<<setw(16)<<"ns/candidate"<<setw(16)<<"ns/linear"<<setw(16)<<"ns/bitmap"<<endl;
+	for (unsigned int c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+		double gen_time = 0.0, hash_time = 0.0, linear_time = 0.0, bitmap_time = 0.0;
+		unsigned int candidates = 0, hits = 0, rect_free = 0, bitmap_free = 0;
+		for (unsigned int r = 0; r < rounds; ++r) {
+			graph.Reset();
+			double start = GetTimeMs();
+			graph.RandomGen(counts[c]);
+			gen_time += GetTimeMs() - start;
+
+			// probe every open door against every tile door, as the fallback in RandomGen does
+			std::vector<Rect> rects;
+			std::vector<const unsigned long long*> masks;
+			std::vector<Vector2> doors;
+			Vector2 door_pos, coord;
+			LocateMode loca_mode;
+			const TileVec &tiles = graph.m_catalog->GetBucket(1);
+			for (unsigned int d = 0; d < graph.m_open_doors.size(); ++d) {
+				for (unsigned int t = 0; t < tiles.size(); ++t) {
+					for (unsigned int k = 0; k < tiles[t]->m_door_count; ++k) {
+						unsigned int combo = graph.DrawCombo();
+						graph.LocateNewTile(&graph.m_open_doors[d], tiles[t], k, combo / 2 + 1, combo % 2, door_pos, coord, loca_mode);
+						rects.push_back(graph.GetTileRect(tiles[t], coord, loca_mode));
+						masks.push_back(tiles[t]->m_variants[loca_mode].m_masks);
+						doors.push_back(graph.m_open_doors[d].locate);
+					}
+				}
+			}
+			candidates += rects.size();
+
+			start = GetTimeMs();
+			for (unsigned int i = 0; i < rects.size(); ++i) {
+				const Rect &rect = rects[i];
+				const ArrangeStore &arranges = graph.m_arranges;
+				bool free = graph.m_spatial.Query(rect, [&](unsigned int a) {
+					return !arranges.Intersect(a, rect);
+				});
+				hits += (free ? 1 : 0) + graph.FindArrange(doors[i]);
+			}
+			hash_time += GetTimeMs() - start;
+
+			start = GetTimeMs();
+			for (unsigned int i = 0; i < rects.size(); ++i) {
+				bool free = true;
+				for (unsigned int a = 0; a < graph.m_arranges.Size() && free; ++a) {
+					free = !graph.m_arranges.Intersect(a, rects[i]);
+				}
+				unsigned int found = InvalidIndex;
+				for (unsigned int a = 0; a < graph.m_arranges.Size() && found == InvalidIndex; ++a) {
+					if (graph.m_arranges.Contain(a, doors[i])) {
+						found = a;
+					}
+				}
+				hits -= (free ? 1 : 0) + found;
+				rect_free += free ? 1 : 0;
+			}
+			linear_time += GetTimeMs() - start;
+
+			// the cell occupancy test CheckTile uses now, overlap only. It also sees the corridors,
+			// so it may reject candidates the rect tests accept
+			start = GetTimeMs();
+			for (unsigned int i = 0; i < rects.size(); ++i) {
+				bitmap_free += graph.m_occupancy.Test(rects[i].x, rects[i].y, rects[i].h, masks[i], 0) ? 1 : 0;
+			}
+			bitmap_time += GetTimeMs() - start;
+		}
+		assert(hits == 0 && bitmap_free <= rect_free);
+		cout<<setw(12)<<counts[c]<<setw(16)<<gen_time / rounds
+			<<setw(16)<<hash_time * 1e6 / candidates<<setw(16)<<linear_time * 1e6 / candidates
+			<<setw(16)<<bitmap_time * 1e6 / candidates<<endl;
+	}
+}
+
+// FNV-1a over the placed rooms and corridors, equal layouts give equal hashes
+unsigned long long Graph::GetLayoutHash() const
+{
+	unsigned long long hash = 14695981039346656037ULL;
+	for (unsigned int i = 0; i < m_arranges.Size(); ++i) {
+		Arrange arrange = m_arranges[i];
+		int values[] = { (int)arrange.m_tile->m_type_id, arrange.m_locate,
+			arrange.m_rect.x, arrange.m_rect.y, arrange.m_rect.h, arrange.m_rect.w };
+		for (unsigned int k = 0; k < sizeof(values) / sizeof(values[0]); ++k) {
+			hash = (hash ^ (unsigned int)values[k]) * 1099511628211ULL;
+		}
+	}
+	for (unsigned int i = 0; i < m_lines.size(); ++i) {
+		int values[] = { m_lines[i].start.x, m_lines[i].start.y, m_lines[i].end.x, m_lines[i].end.y };
+		for (unsigned int k = 0; k < sizeof(values) / sizeof(values[0]); ++k) {
+			hash = (hash ^ (unsigned int)values[k]) * 1099511628211ULL;
+		}
+	}
+	return hash;
+}
+
+// writes the layout as a dungeon file, the room graph must be compacted (it is after every generation)
+bool Graph::Save(const char *path) const
+{
+	if (!IsLittleEndian()) {
+		return false;
+	}
+	const unsigned int room_count = m_arranges.Size();
+	const unsigned int edge_count = m_adj_list.GetNodeCount() == room_count ? m_adj_list.GetEdgeCount() * 2 : 0;
+	assert(edge_count > 0 || room_count <= 1);
+	size_t rooms_size = AlignFileSection(room_count * sizeof(DungeonFileRoom));
+	size_t corridors_size = AlignFileSection(m_lines.size() * sizeof(DungeonFileCorridor));
+	size_t graph_size = AlignFileSection((room_count + 1 + edge_count) * sizeof(unsigned int));
+	std::vector<unsigned char> buffer(sizeof(DungeonFileHeader) + rooms_size + corridors_size + graph_size, 0);
+	unsigned char *payload = buffer.data() + sizeof(DungeonFileHeader);
+
+	DungeonFileRoom *rooms = (DungeonFileRoom*)payload;
+	for (unsigned int i = 0; i < room_count; ++i) {
+		Arrange arrange = m_arranges[i];
+		DungeonFileRoom &room = rooms[i];
+		room.tile_id = arrange.m_tile->m_type_id;
+		room.locate = arrange.m_locate;
+		room.pivot_x = arrange.m_pivot.x;
+		room.pivot_y = arrange.m_pivot.y;
+		room.x = arrange.m_rect.x;
+		room.y = arrange.m_rect.y;
+		room.h = arrange.m_rect.h;
+		room.w = arrange.m_rect.w;
+	}
+	DungeonFileCorridor *corridors = (DungeonFileCorridor*)(payload + rooms_size);
+	for (unsigned int i = 0; i < m_lines.size(); ++i) {
+		corridors[i].start_x = m_lines[i].start.x;
+		corridors[i].start_y = m_lines[i].start.y;
+		corridors[i].end_x = m_lines[i].end.x;
+		corridors[i].end_y = m_lines[i].end.y;
+	}
+	unsigned int *offsets = (unsigned int*)(payload + rooms_size + corridors_size);
+	unsigned int *targets = offsets + room_count + 1;
+	offsets[0] = 0;
+	for (unsigned int i = 0; i < room_count; ++i) {
+		unsigned int degree = edge_count > 0 ? m_adj_list.GetDegree(i) : 0;
+		if (degree > 0) {
+			memcpy(targets + offsets[i], m_adj_list.GetNeighbors(i), degree * sizeof(unsigned int));
+		}
+		offsets[i + 1] = offsets[i] + degree;
+	}
+
+	DungeonFileHeader *header = (DungeonFileHeader*)buffer.data();
+	memcpy(header->magic, DungeonFileMagic, sizeof(DungeonFileMagic));
+	header->version = DungeonFileVersion;
+	header->seed = m_seed;
+	header->layout_hash = GetLayoutHash();
+	header->room_count = room_count;
+	header->corridor_count = m_lines.size();
+	header->edge_count = edge_count;
+	header->payload_size = buffer.size() - sizeof(DungeonFileHeader);
+	header->payload_checksum = FileChecksum(payload, (size_t)header->payload_size);
+	header->header_checksum = FileChecksum(header, offsetof(DungeonFileHeader, header_checksum));
+
+	FILE *file = fopen(path, "wb");
+	if (file == NULL) {
+		return false;
+	}
+	bool ok = fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+	return fclose(file) == 0 && ok;
+}
+
+// false when the layout does not fit a CompactLayout: no rooms, more tile types than CompactPaletteSize,
+// or a corridor that does not run from a door of the parent to a door of the room
+bool Graph::Encode(CompactLayout &layout) const
+{
+	layout.Clear();
+	const unsigned int count = m_arranges.Size();
+	if (count == 0 || m_lines.size() + 1 < count || m_adj_list.GetNodeCount() != count) {
+		return false;
+	}
+	IndexVec palette;
+	for (unsigned int i = 0; i < count; ++i) {
+		unsigned int id = m_arranges.GetTile(i)->m_type_id;
+		if (std::find(palette.begin(), palette.end(), id) == palette.end()) {
+			if (palette.size() == CompactPaletteSize) {
+				return false;
+			}
+			palette.push_back(id);
+		}
+	}
+
+	std::vector<unsigned char> &data = layout.m_data;
+	const unsigned int spine_count = m_lines.size() + 1 - count;
+	data.resize(palette.size() * sizeof(unsigned int));
+	memcpy(data.data(), palette.data(), data.size());
+	for (unsigned int i = 0; i < spine_count; ++i) {
+		PutVarint(data, ZigZag(m_lines[i].start.x));
+		PutVarint(data, ZigZag(m_lines[i].start.y));
+		PutVarint(data, ZigZag(m_lines[i].end.x));
+		PutVarint(data, ZigZag(m_lines[i].end.y));
+	}
+	const unsigned int rooms_offset = data.size();
+	for (unsigned int i = 0; i < count; ++i) {
+		unsigned int kind = std::find(palette.begin(), palette.end(), m_arranges.GetTile(i)->m_type_id) - palette.begin();
+		data.push_back((unsigned char)(kind << 3 | m_arranges.GetLocate(i)));
+	}
+	const unsigned int checkpoints_offset = data.size();
+	data.resize(checkpoints_offset + ((count + CompactBlockSize - 1) >> CompactBlockShift) * sizeof(unsigned int));
+	const unsigned int stream_offset = data.size();
+
+	Vector2 last(0, 0);
+	for (unsigned int i = 0; i < count; ++i) {
+		const Vector2 pivot = m_arranges[i].m_pivot;
+		if ((i & (CompactBlockSize - 1)) == 0) {
+			unsigned int offset = data.size() - stream_offset;
+			memcpy(data.data() + checkpoints_offset + (i >> CompactBlockShift) * sizeof(offset), &offset, sizeof(offset));
+			last.Set(0, 0);
+		}
+		PutVarint(data, ZigZag(pivot.x - last.x));
+		PutVarint(data, ZigZag(pivot.y - last.y));
+		last = pivot;
+		if (i == 0) {
+			continue;
+		}
+
+		// a tree: the only neighbour placed before the room is its parent
+		unsigned int parent = InvalidIndex;
+		const unsigned int *adj = m_adj_list.GetNeighbors(i);
+		for (unsigned int k = 0; k < m_adj_list.GetDegree(i); ++k) {
+			if (adj[k] < i) {
+				parent = parent == InvalidIndex ? adj[k] : i;
+			}
+		}
+		const Line &line = m_lines[spine_count + i - 1];
+		unsigned int parent_door = MaxDoorCount, door = MaxDoorCount;
+		if (parent < i) {
+			const Tile *tile = m_arranges.GetTile(parent);
+			const TileVariant &variant = tile->m_variants[m_arranges.GetLocate(parent)];
+			Vector2 parent_pivot = m_arranges[parent].m_pivot;
+			for (unsigned int k = 0; k < tile->m_door_count && parent_door == MaxDoorCount; ++k) {
+				parent_door = parent_pivot + variant.m_doors[k].locate == line.start ? k : MaxDoorCount;
+			}
+		}
+		const Tile *tile = m_arranges.GetTile(i);
+		const TileVariant &variant = tile->m_variants[m_arranges.GetLocate(i)];
+		for (unsigned int k = 0; k < tile->m_door_count && door == MaxDoorCount; ++k) {
+			door = pivot + variant.m_doors[k].locate == line.end ? k : MaxDoorCount;
+		}
+		if (parent_door == MaxDoorCount || door == MaxDoorCount) {
+			layout.Clear();
+			return false;
+		}
+		PutVarint(data, (unsigned long long)(i - parent) << 4 | parent_door << 2 | door);
+	}
+	data.shrink_to_fit();
+	layout.m_room_count = count;
+	layout.m_palette_size = palette.size();
+	layout.m_spine_count = spine_count;
+	layout.m_rooms_offset = rooms_offset;
+	return true;
+}
+
+// expands an encoded layout into the working structures, as if this graph had generated it: FindPath,
+// FindCellPath, Rasterize and Save work on it, a further GenExact starts over. The tile library must
+// have the tiles the layout was encoded with, false when a tile type is missing
+bool Graph::Decode(const CompactLayout &layout)
+{
+	Reset();
+	const Tile *palette[CompactPaletteSize];
+	for (unsigned int i = 0; i < layout.GetPaletteSize(); ++i) {
+		palette[i] = m_catalog->FindTile(layout.GetPaletteId(i));
+		if (palette[i] == NULL) {
+			return false;
+		}
+	}
+	const unsigned int count = layout.GetRoomCount();
+	m_arranges.Reserve(count);
+	m_placements.reserve(count);
+	m_lines.reserve(count + layout.GetSpineCount());
+	m_adj_list.Reserve(count);
+
+	for (unsigned int i = 0; i < layout.GetSpineCount(); ++i) {
+		Line spine = layout.GetSpine(i);
+		AddLink(spine.start, spine.end);
+		m_occupancy.SetRect(Rect(spine.start.x, spine.start.y, spine.end.x - spine.start.x + 1, spine.end.y - spine.start.y + 1));
+	}
+	layout.ForEachRoom([this, &palette](unsigned int, const CompactRoom &room) {
+		const Tile *tile = palette[room.palette];
+		if (room.parent != InvalidIndex) {
+			const Tile *parent = m_arranges.GetTile(room.parent);
+			Vector2 start = m_arranges[room.parent].m_pivot
+				+ parent->m_variants[m_arranges.GetLocate(room.parent)].m_doors[room.parent_door].locate;
+			Vector2 end = room.pivot + tile->m_variants[room.locate].m_doors[room.door].locate;
+			AddLink(start, end);
+			Rect corridor;
+			if (GetCorridorRect(start, end, corridor)) {
+				m_occupancy.SetRect(corridor);
+			}
+		}
+		LinkTile(room.parent, tile, room.pivot, room.locate);
+	});
+	m_adj_list.Compact(count);
+	return true;
+}
+
+// bytes held by the layout containers, including reserved but unused capacity
+size_t Graph::GetMemoryUsage() const
+{
+	return m_arranges.GetMemoryUsage() + m_spatial.GetMemoryUsage() + m_adj_list.GetMemoryUsage()
+		+ m_occupancy.GetMemoryUsage() + m_open_doors.capacity() * sizeof(Door) + m_frontier.GetMemoryUsage() + m_lines.capacity() * sizeof(Line)
+		+ (m_path_dist.capacity() + m_path_prev.capacity() + m_path_queue.capacity()) * sizeof(unsigned int)
+		+ m_distances.GetMemoryUsage() + m_navigator.GetMemoryUsage() + m_cell_rooms.capacity() * sizeof(unsigned int)
+		+ m_raster.GetMemoryUsage();
+}
+
+const int ChunkSize = 96;	// world cells per chunk side
+const unsigned int ChunkTileCount = 24;	// tiles a chunk tries to hold
+
+// copies the rooms, corridors and room graph edges (as pairs of room indices) out of a generated graph
+void CopyLayout(const Graph &graph, std::vector<Arrange> &rooms, LineVec &lines, IndexVec &edges)
+{
+	const ArrangeStore &arranges = graph.GetArranges();
+	rooms.clear();
+	rooms.reserve(arranges.Size());
+	for (unsigned int i = 0; i < arranges.Size(); ++i) {
+		rooms.push_back(arranges[i]);
+	}
+	lines = graph.GetLines();
+	edges.clear();
+	const RoomGraph &room_graph = graph.GetRoomGraph();
+	for (unsigned int i = 0; i < room_graph.GetNodeCount(); ++i) {
+		const unsigned int *adj = room_graph.GetNeighbors(i);
+		for (unsigned int j = 0; j < room_graph.GetDegree(i); ++j) {
+			if (i < adj[j]) {
+				edges.push_back(i);
+				edges.push_back(adj[j]);
+			}
+		}
+	}
+}
+
+// one generated chunk of the open world, room indices in "edges" are local to the chunk
+struct Chunk{
+	int cx, cy;
+	std::vector<Arrange> rooms;
+	LineVec lines;
+	IndexVec edges;	// pairs of room indices
+	unsigned long long hash;
+};
+
+// an unbounded world cut into ChunkSize x ChunkSize chunks. Chunks are generated when the
+// query point comes near and dropped when it moves away; a chunk is a pure function of the
+// world seed and its chunk coordinate, so a revisited chunk comes back exactly as it was
+class ChunkedWorld{
+	typedef std::map<unsigned long long, Chunk*> ChunkMap;
+	Graph m_generator;
+	ChunkMap m_chunks;
+	unsigned long long m_seed;
+	int m_radius;	// chunks within this Chebyshev distance of the query point are kept
+	unsigned int m_generated;
+private:
+	static unsigned long long ChunkKey(int cx, int cy) {
+		return ((unsigned long long)(unsigned int)cx << 32) | (unsigned int)cy;
+	}
+	Chunk* Generate(int cx, int cy);
+public:
+	ChunkedWorld(unsigned long long seed, int radius = 1);
+	~ChunkedWorld();
+	static int GetChunkCoord(int v) { return v >= 0 ? v / ChunkSize : -((-v - 1) / ChunkSize) - 1; }
+	unsigned long long GetChunkSeed(int cx, int cy) const;
+	void Update(const Vector2 &pos);
+	const Chunk* GetChunk(int cx, int cy) const;
+	unsigned int GetChunkCount() const { return m_chunks.size(); }
+	unsigned int GetGeneratedCount() const { return m_generated; }
+	size_t GetMemoryUsage() const;
+};
+
+ChunkedWorld::ChunkedWorld(unsigned long long seed, int radius)
+	: m_seed(seed), m_radius(radius), m_generated(0)
+{
+}
+
+ChunkedWorld::~ChunkedWorld()
+{
+	for (ChunkMap::iterator itr = m_chunks.begin(); itr != m_chunks.end(); ++itr) {
+		delete itr->second;
+	}
+	m_chunks.clear();
+}
+
+unsigned long long ChunkedWorld::GetChunkSeed(int cx, int cy) const
+{
+	Random random(m_seed, ChunkKey(cx, cy));
+	return ((unsigned long long)random.Next() << 32) | random.Next();
+}
+
+Chunk* ChunkedWorld::Generate(int cx, int cy)
+{
+	Rect bounds(cx * ChunkSize, cy * ChunkSize, ChunkSize, ChunkSize);
+	m_generator.GenChunk(bounds, ChunkTileCount, GetChunkSeed(cx, cy));
+	++m_generated;
+
+	Chunk *chunk = new Chunk;
+	chunk->cx = cx;
+	chunk->cy = cy;
+	CopyLayout(m_generator, chunk->rooms, chunk->lines, chunk->edges);
+	chunk->hash = m_generator.GetLayoutHash();
+	return chunk;
+}
+
+// generates the missing chunks around pos and drops the ones that fell out of range,
+// the cost is proportional to the chunks entering the range, not to the world explored so far
+void ChunkedWorld::Update(const Vector2 &pos)
+{
+	int cx = GetChunkCoord(pos.x), cy = GetChunkCoord(pos.y);
+	ChunkMap::iterator itr = m_chunks.begin();
+	while (itr != m_chunks.end()) {
+		Chunk *chunk = itr->second;
+		if (std::abs(chunk->cx - cx) > m_radius || std::abs(chunk->cy - cy) > m_radius) {
+			delete chunk;
+			m_chunks.erase(itr++);
+		}
+		else {
+			++itr;
+		}
+	}
+
+	for (int x = cx - m_radius; x <= cx + m_radius; ++x) {
+		for (int y = cy - m_radius; y <= cy + m_radius; ++y) {
+			unsigned long long key = ChunkKey(x, y);
+			if (m_chunks.find(key) == m_chunks.end()) {
+				m_chunks[key] = Generate(x, y);
+			}
+		}
+	}
+}
+
+const Chunk* ChunkedWorld::GetChunk(int cx, int cy) const
+{
+	ChunkMap::const_iterator itr = m_chunks.find(ChunkKey(cx, cy));
+	return itr == m_chunks.end() ? NULL : itr->second;
+}
+
+size_t ChunkedWorld::GetMemoryUsage() const
+{
+	size_t bytes = m_generator.GetMemoryUsage();
+	for (ChunkMap::const_iterator itr = m_chunks.begin(); itr != m_chunks.end(); ++itr) {
+		const Chunk *chunk = itr->second;
+		bytes += sizeof(Chunk) + chunk->rooms.capacity() * sizeof(Arrange)
+			+ chunk->lines.capacity() * sizeof(Line) + chunk->edges.capacity() * sizeof(unsigned int);
+	}
+	return bytes;
+}
+
+struct BatchResult{
+	unsigned long long seed;
+	unsigned int tile_count;
+	bool ok;
+	GenStats stats;	// of this dungeon alone, add them up for the batch
+};
+
+typedef std::vector<BatchResult> BatchResultVec;
+typedef std::function<void(unsigned int, const Graph&)> BatchVisitor;
+
+// seed of the index-th dungeon of a batch, it depends only on base_seed and index,
+// so a batch gives the same dungeons whatever the thread count is
+unsigned long long GetBatchSeed(unsigned long long base_seed, unsigned int index)
+{
+	Random random(base_seed, index);
+	return ((unsigned long long)random.Next() << 32) | random.Next();
+}
+
+// generates "count" dungeons of exactly "tile_count" tiles, each worker reuses one Graph over "catalog".
+// visitor(index, graph) is called on the worker thread right after the index-th dungeon is built
+void GenerateBatch(unsigned int count, unsigned int tile_count, unsigned long long base_seed, unsigned int threads,
+				   const TileCatalogPtr &catalog, BatchResultVec &results, const BatchVisitor &visitor = BatchVisitor())
+{
+	WorkStealingPool pool(threads);
+	std::vector<Graph*> graphs;
+	for (unsigned int i = 0; i < pool.GetThreadCount(); ++i) {
+		graphs.push_back(new Graph(catalog));
+	}
+
+	results.resize(count);
+	pool.Run(count, [&](unsigned int worker, unsigned int index) {
+		Graph &graph = *graphs[worker];
+		BatchResult &result = results[index];
+		result.seed = GetBatchSeed(base_seed, index);
+		graph.Seed(result.seed);
+		graph.ResetStats();
+		result.ok = graph.GenExact(tile_count);
+		result.stats = graph.GetStats();
+		result.tile_count = graph.GetTileCount();
+		if (visitor) {
+			visitor(index, graph);
+		}
+	});
+
+	for (unsigned int i = 0; i < graphs.size(); ++i) {
+		delete graphs[i];
+	}
+}
+
+// what a LevelPool generates, see LevelPool::AddConfig
+struct LevelConfig{
+	unsigned int tile_count;
+	unsigned int max_rounds;
+	unsigned int corridor_length;
+	TileMix mix;
+	explicit LevelConfig(unsigned int tiles = 50) : tile_count(tiles), max_rounds(DefaultExactRounds), corridor_length(MaxCorridorLength) { }
+};
+
+// a finished layout, copied out of the Graph that built it. The rooms point at the tiles of "catalog",
+// which the level holds on to
+struct Level{
+	unsigned int config_id;
+	unsigned long long seed;
+	bool ok;	// false only for a seed chosen by the caller that GenExact could not finish
+	bool stocked;	// made ahead of the request
+	std::vector<Arrange> rooms;
+	LineVec lines;
+	IndexVec edges;	// pairs of room indices
+	unsigned long long hash;	// Graph::GetLayoutHash
+	double generate_ms;
+	TileCatalogPtr catalog;
+};
+
+typedef std::shared_ptr<const Level> LevelPtr;
+typedef std::function<void(const LevelPtr&)> LevelCallback;
+
+const unsigned long long AnySeed = ~0ULL;	// a request that takes whatever level is ready
+
+// hands out levels without blocking on GenExact. Every configuration keeps a stock of finished levels
+// that background threads refill whenever no request is waiting. A request takes a level from the
+// stock under one lock, only when the stock has none to match is the level generated on demand,
+// ahead of any refill. The stock of a configuration is made from GetBatchSeed(base_seed, n) for
+// n = 0, 1, 2..., so any level handed out can be rebuilt from its seed
+class LevelPool{
+	struct Stock{
+		LevelConfig config;
+		unsigned long long base_seed;
+		unsigned int next_seed;	// index of the next seed to generate
+		unsigned int target;	// levels to keep ready
+		unsigned int pending;	// refills in progress
+		std::deque<LevelPtr> ready;
+	};
+	struct Order{
+		unsigned int config_id;
+		unsigned long long seed;
+		LevelCallback done;
+	};
+
+	TileCatalogPtr m_catalog;	// every worker generates from it
+	std::vector<Stock*> m_stocks;
+	std::deque<Order> m_orders;	// requests the stock could not serve
+	std::vector<std::thread> m_workers;
+	std::mutex m_lock;	// guards everything above and the counters
+	std::condition_variable m_wake;	// an order came in or a stock went below its target
+	std::condition_variable m_stocked;	// a refill finished
+	bool m_stop;
+	unsigned int m_from_stock, m_on_demand;
+private:
+	LevelPool(const LevelPool&);
+	LevelPool& operator=(const LevelPool&);
+	bool FindRefill(unsigned int &config_id) const;
+	unsigned long long NextSeed(Stock &stock) { return GetBatchSeed(stock.base_seed, stock.next_seed++); }
+	void Work();
+public:
+	explicit LevelPool(unsigned int threads = 0, const TileCatalogPtr &catalog = TileCatalog::GetBuiltin());
+	~LevelPool();
+	unsigned int GetThreadCount() const { return m_workers.size(); }
+	unsigned int AddConfig(const LevelConfig &config, unsigned int stock = 0, unsigned long long base_seed = 0);
+	void Request(unsigned int config_id, const LevelCallback &done, unsigned long long seed = AnySeed);
+	std::future<LevelPtr> Request(unsigned int config_id, unsigned long long seed = AnySeed);
+	void WaitForStock();
+	unsigned int GetStock(unsigned int config_id);
+	unsigned int GetServedFromStock();
+	unsigned int GetServedOnDemand();
+};
+
+// threads = 0 leaves one core to the caller
+LevelPool::LevelPool(unsigned int threads, const TileCatalogPtr &catalog) : m_catalog(catalog), m_stop(false), m_from_stock(0), m_on_demand(0)
+{
+	if (threads == 0) {
+		threads = std::thread::hardware_concurrency();
+		threads = threads > 1 ? threads - 1 : 1;
+	}
+	for (unsigned int i = 0; i < threads; ++i) {
+		m_workers.push_back(std::thread(&LevelPool::Work, this));
+	}
+}
+
+// the orders still queued are served first, the stock is dropped
+LevelPool::~LevelPool()
+{
 	{
-	case Rotate0:
-		vec.Set(v.x, v.y);
-		break;
-	case Rotate90:
-		vec.Set(v.y, -v.x);
-		break;
-	case Rotate180:
-		vec.Set(-v.x, -v.y);
-		break;
-	case Rotate270:
-		vec.Set(-v.y, v.x);
-		break;
-	case HoriMirror:
-		vec.Set(v.x, -v.y);
-		break;
-	case VertMirror:
-		vec.Set(-v.x, v.y);
-		break;
-	default:
-		assert(0);
-		break;
+		std::lock_guard<std::mutex> guard(m_lock);
+		m_stop = true;
+	}
+	m_wake.notify_all();
+	for (unsigned int i = 0; i < m_workers.size(); ++i) {
+		m_workers[i].join();
+	}
+	for (unsigned int i = 0; i < m_stocks.size(); ++i) {
+		delete m_stocks[i];
+	}
+	m_stocks.clear();
+}
+
+// returns the id to request the configuration by, or InvalidIndex when it asks for fewer than 2 tiles or
+// a Graph over the pool's catalog refuses its mix or corridor length. "stock" levels are kept ready,
+// 0 makes every request generate on demand
+unsigned int LevelPool::AddConfig(const LevelConfig &config, unsigned int stock, unsigned long long base_seed)
+{
+	Graph graph(m_catalog);
+	if (config.tile_count < 2 || !graph.SetTileMix(config.mix) || !graph.SetCorridorLength(config.corridor_length)) {
+		return InvalidIndex;
+	}
+
+	Stock *s = new Stock;
+	s->config = config;
+	s->base_seed = base_seed;
+	s->next_seed = 0;
+	s->target = stock;
+	s->pending = 0;
+	unsigned int config_id = 0;
+	{
+		std::lock_guard<std::mutex> guard(m_lock);
+		config_id = m_stocks.size();
+		m_stocks.push_back(s);
+	}
+	m_wake.notify_all();
+	return config_id;
+}
+
+// with the lock held
+bool LevelPool::FindRefill(unsigned int &config_id) const
+{
+	// the emptiest stock first, relative to its target
+	double lowest = 1.0;
+	for (unsigned int i = 0; i < m_stocks.size(); ++i) {
+		const Stock &stock = *m_stocks[i];
+		double fill = stock.target > 0 ? (double)(stock.ready.size() + stock.pending) / stock.target : 1.0;
+		if (fill < lowest) {
+			lowest = fill;
+			config_id = i;
+		}
+	}
+	return lowest < 1.0;
+}
+
+void LevelPool::Work()
+{
+	Graph graph(m_catalog);
+	unsigned int graph_config = InvalidIndex;	// the configuration graph is set up for
+	std::unique_lock<std::mutex> guard(m_lock);
+	while (true) {
+		Order order;
+		bool refill = false;
+		if (!m_orders.empty()) {
+			order = m_orders.front();
+			m_orders.pop_front();
+		}
+		else if (!m_stop && FindRefill(order.config_id)) {
+			refill = true;
+			order.seed = AnySeed;
+			++m_stocks[order.config_id]->pending;
+		}
+		else if (m_stop) {
+			break;
+		}
+		else {
+			m_wake.wait(guard);
+			continue;
+		}
+
+		// a stock is never removed and its config never changes, so both are safe to read unlocked
+		Stock &stock = *m_stocks[order.config_id];
+		const bool any_seed = order.seed == AnySeed;
+		unsigned long long seed = any_seed ? NextSeed(stock) : order.seed;
+		guard.unlock();
+
+		if (graph_config != order.config_id) {
+			graph.SetTileMix(stock.config.mix);
+			graph.SetCorridorLength(stock.config.corridor_length);
+			graph_config = order.config_id;
+		}
+		Level *level = new Level;
+		level->config_id = order.config_id;
+		level->stocked = refill;
+		double start = GetTimeMs();
+		while (true) {
+			graph.Seed(seed);
+			level->seed = seed;
+			level->ok = graph.GenExact(stock.config.tile_count, stock.config.max_rounds);
+			if (level->ok || !any_seed) {
+				break;
+			}
+			// a failed stock seed is skipped, the next one in the sequence takes its place
+			guard.lock();
+			seed = NextSeed(stock);
+			guard.unlock();
+		}
+		level->generate_ms = GetTimeMs() - start;
+		CopyLayout(graph, level->rooms, level->lines, level->edges);
+		level->hash = graph.GetLayoutHash();
+		level->catalog = m_catalog;
+		LevelPtr result(level);
+
+		if (refill) {
+			guard.lock();
+			--stock.pending;
+			stock.ready.push_back(result);
+			m_stocked.notify_all();
+		}
+		else {
+			order.done(result);
+			guard.lock();
+		}
+	}
+}
+
+// done(level) runs on the calling thread before Request returns when the stock has a match,
+// otherwise on a pool thread once the level is generated
+void LevelPool::Request(unsigned int config_id, const LevelCallback &done, unsigned long long seed)
+{
+	LevelPtr level;
+	{
+		std::lock_guard<std::mutex> guard(m_lock);
+		assert(config_id < m_stocks.size());
+		std::deque<LevelPtr> &ready = m_stocks[config_id]->ready;
+		for (std::deque<LevelPtr>::iterator itr = ready.begin(); itr != ready.end(); ++itr) {
+			if (seed == AnySeed || (*itr)->seed == seed) {
+				level = *itr;
+				ready.erase(itr);
+				break;
+			}
+		}
+		if (level) {
+			++m_from_stock;
+		}
+		else {
+			++m_on_demand;
+			Order order;
+			order.config_id = config_id;
+			order.seed = seed;
+			order.done = done;
+			m_orders.push_back(order);
+		}
+	}
+	// either way a worker has something to do: the order, or refilling what was taken
+	m_wake.notify_one();
+	if (level) {
+		done(level);
+	}
+}
+
+std::future<LevelPtr> LevelPool::Request(unsigned int config_id, unsigned long long seed)
+{
+	std::shared_ptr<std::promise<LevelPtr> > promise(new std::promise<LevelPtr>);
+	std::future<LevelPtr> future = promise->get_future();
+	Request(config_id, [promise](const LevelPtr &level) { promise->set_value(level); }, seed);
+	return future;
+}
+
+// blocks until every stock is at its target, to warm the pool up before the first request
+void LevelPool::WaitForStock()
+{
+	std::unique_lock<std::mutex> guard(m_lock);
+	while (true) {
+		bool full = true;
+		for (unsigned int i = 0; i < m_stocks.size(); ++i) {
+			full = full && m_stocks[i]->ready.size() >= m_stocks[i]->target;
+		}
+		if (full) {
+			break;
+		}
+		m_stocked.wait(guard);
+	}
+}
+
+unsigned int LevelPool::GetStock(unsigned int config_id)
+{
+	std::lock_guard<std::mutex> guard(m_lock);
+	return m_stocks[config_id]->ready.size();
+}
+
+unsigned int LevelPool::GetServedFromStock()
+{
+	std::lock_guard<std::mutex> guard(m_lock);
+	return m_from_stock;
+}
+
+unsigned int LevelPool::GetServedOnDemand()
+{
+	std::lock_guard<std::mutex> guard(m_lock);
+	return m_on_demand;
+}
+
+// one point of the parameter sweep
+struct SweepConfig{
+	unsigned int tile_count;
+	unsigned int corridor_length;
+	unsigned int max_rounds;
+	unsigned int mix;	// index into the sweep's tile mixes
+};
+
+struct SweepResult{
+	SweepConfig config;
+	unsigned int runs, first_try, successes;
+	IndexVec attempts;	// GenExact rounds of every success, sorted
+	double total_ms;	// all runs, failed ones included
+	double GetCostPerSuccess() const { return successes > 0 ? total_ms / successes : 1e30; }
+};
+
+typedef std::vector<SweepResult> SweepResultVec;
+
+// generates "seeds" dungeons for every combination of tile count, corridor length, max_rounds and tile
+// mix on all cores. Per combination it records how often RandomGen gets every room on the first try,
+// how often GenExact gets them within max_rounds rounds, the rounds a success took and the time per
+// success. Every combination goes to the CSV file "path", the cheapest one per tile count to stdout.
+// The workers share "catalog", mixes that leave it without link tiles are left out
+void RunSweep(unsigned int seeds, unsigned int threads, const char *path, const TileCatalogPtr &catalog)
+{
+	const unsigned int tile_counts[] = { 22, 50, 100, 200 };
+	const unsigned int corridor_lengths[] = { 2, 3, 4, 5 };
+	const unsigned int max_rounds[] = { 4, 16, DefaultExactRounds };
+	const char *mix_names[] = { "default", "hubs", "dead ends" };
+	TileMix mixes[3];
+	mixes[1].door_shares[1] = 0.3;
+	mixes[1].door_shares[2] = mixes[1].door_shares[3] = 3.0;
+	mixes[2].door_shares[0] = 0.3;
+	const unsigned int mix_count = sizeof(mixes) / sizeof(mixes[0]);
+
+	Graph probe(catalog);
+	bool usable[mix_count];
+	for (unsigned int x = 0; x < mix_count; ++x) {
+		usable[x] = probe.SetTileMix(mixes[x]);
+	}
+
+	SweepResultVec results;
+	for (unsigned int t = 0; t < sizeof(tile_counts) / sizeof(tile_counts[0]); ++t) {
+		for (unsigned int c = 0; c < sizeof(corridor_lengths) / sizeof(corridor_lengths[0]); ++c) {
+			for (unsigned int m = 0; m < sizeof(max_rounds) / sizeof(max_rounds[0]); ++m) {
+				for (unsigned int x = 0; x < mix_count; ++x) {
+					if (!usable[x]) {
+						continue;
+					}
+					SweepResult result;
+					result.config.tile_count = tile_counts[t];
+					result.config.corridor_length = corridor_lengths[c];
+					result.config.max_rounds = max_rounds[m];
+					result.config.mix = x;
+					result.runs = result.first_try = result.successes = 0;
+					result.total_ms = 0.0;
+					results.push_back(result);
+				}
+			}
+		}
+	}
+
+	// one job per (combination, seed), the seed depends on the index within the combination only,
+	// so every combination sees the same seeds
+	struct Run{
+		bool ok, first_try;
+		unsigned int attempts;
+		double ms;
+	};
+	std::vector<Run> runs(results.size() * seeds);
+	WorkStealingPool pool(threads);
+	std::vector<Graph*> graphs;
+	IndexVec graph_mixes(pool.GetThreadCount(), 0);	// a new Graph has the default mix
+	for (unsigned int i = 0; i < pool.GetThreadCount(); ++i) {
+		graphs.push_back(new Graph(catalog));
+	}
+	double start = GetTimeMs();
+	pool.Run(runs.size(), [&](unsigned int worker, unsigned int index) {
+		Graph &graph = *graphs[worker];
+		const SweepConfig &config = results[index / seeds].config;
+		if (graph.GetCorridorLength() != config.corridor_length) {
+			graph.SetCorridorLength(config.corridor_length);
+		}
+		// rebuilding the alias tables is not free, jobs of one combination are mostly adjacent
+		if (graph_mixes[worker] != config.mix) {
+			graph.SetTileMix(mixes[config.mix]);
+			graph_mixes[worker] = config.mix;
+		}
+		graph.Seed(GetBatchSeed(20121001, index % seeds));
+		double begin = GetTimeMs();
+		Run &run = runs[index];
+		run.ok = graph.GenExact(config.tile_count, config.max_rounds);
+		run.ms = GetTimeMs() - begin;
+		run.attempts = graph.GetAttempts();
+		run.first_try = run.ok && run.attempts == 1;
+	});
+	double wall_time = GetTimeMs() - start;
+	for (unsigned int i = 0; i < graphs.size(); ++i) {
+		delete graphs[i];
+	}
+
+	std::ofstream out(path);
+	out<<"tile_count,corridor_length,max_rounds,mix,runs,first_try,successes,attempts_p50,attempts_p95,attempts_max,ms_per_success\n";
+	for (unsigned int r = 0; r < results.size(); ++r) {
+		SweepResult &result = results[r];
+		for (unsigned int i = r * seeds; i < (r + 1) * seeds; ++i) {
+			++result.runs;
+			result.first_try += runs[i].first_try ? 1 : 0;
+			result.successes += runs[i].ok ? 1 : 0;
+			result.total_ms += runs[i].ms;
+			if (runs[i].ok) {
+				result.attempts.push_back(runs[i].attempts);
+			}
+		}
+		std::sort(result.attempts.begin(), result.attempts.end());
+		const IndexVec &a = result.attempts;
+		const SweepConfig &config = result.config;
+		out<<config.tile_count<<','<<config.corridor_length<<','<<config.max_rounds<<','<<mix_names[config.mix]<<','
+			<<result.runs<<','<<result.first_try<<','<<result.successes<<','
+			<<(a.empty() ? 0 : a[a.size() / 2])<<','<<(a.empty() ? 0 : a[a.size() * 95 / 100])<<','<<(a.empty() ? 0 : a.back())<<','
+			<<(result.successes > 0 ? result.GetCostPerSuccess() : 0.0)<<'\n';
+	}
+
+	cout<<runs.size()<<" dungeons in "<<wall_time<<" ms on "<<pool.GetThreadCount()<<" threads, every combination in "<<path<<endl;
+	cout<<setw(8)<<"tiles"<<setw(10)<<"corridor"<<setw(12)<<"max rounds"<<setw(11)<<"mix"<<setw(11)<<"first try"
+		<<setw(10)<<"success"<<setw(13)<<"rounds p95"<<setw(14)<<"ms/success"<<endl;
+	for (unsigned int t = 0; t < sizeof(tile_counts) / sizeof(tile_counts[0]); ++t) {
+		// the cheapest combination, then the defaults to compare with
+		const SweepResult *best = NULL, *defaults = NULL;
+		for (unsigned int r = 0; r < results.size(); ++r) {
+			const SweepResult &result = results[r];
+			if (result.config.tile_count != tile_counts[t]) {
+				continue;
+			}
+			if (best == NULL || result.GetCostPerSuccess() < best->GetCostPerSuccess()) {
+				best = &result;
+			}
+			if (result.config.corridor_length == MaxCorridorLength && result.config.max_rounds == DefaultExactRounds && result.config.mix == 0) {
+				defaults = &result;
+			}
+		}
+		const SweepResult *rows[] = { best, defaults };
+		for (unsigned int k = 0; k < 2; ++k) {
+			// a grid without the defaults or without this tile count has nothing to show
+			if (rows[k] == NULL || rows[k]->runs == 0) {
+				continue;
+			}
+			const SweepResult &result = *rows[k];
+			const IndexVec &a = result.attempts;
+			cout<<setw(8)<<result.config.tile_count<<setw(10)<<result.config.corridor_length<<setw(12)<<result.config.max_rounds
+				<<setw(11)<<mix_names[result.config.mix]<<setw(10)<<result.first_try * 100.0 / result.runs<<"%"
+				<<setw(9)<<result.successes * 100.0 / result.runs<<"%"<<setw(13)<<(a.empty() ? 0 : a[a.size() * 95 / 100])
+				<<setw(14)<<result.GetCostPerSuccess()<<(k == 0 ? "  cheapest" : "  default")<<endl;
+		}
 	}
-	return vec;
 }
 
-bool Graph::RandomGen(unsigned int tile_count)
+// throughput of GenerateBatch against the thread count, the checksum must not change
+void BenchBatch(unsigned int count, unsigned int max_threads, const TileCatalogPtr &catalog)
 {
-	assert(tile_count > 1 && tile_count <= MaxTileCount);
-	Vector2 coord(MaxTileCount * MaxTileHeight/2, MaxTileCount * MaxTileWidth/2);
-	LocateMode loca_mode = (LocateMode)m_random.GetRand(Rotate0, LocateModeCount - 1);
-	loca_mode = Rotate0;
-	Tile *tile = ChooseLinkTile();
-	// the first tile as the root
-	AddDoors(tile, coord, loca_mode, InvalidIndex);
-	LinkTile(InvalidIndex, tile, coord, loca_mode);
+	const unsigned int tile_count = 22;
+	const unsigned long long base_seed = 20121001;
+	if (max_threads == 0) {
+		max_threads = std::max<unsigned int>(std::thread::hardware_concurrency(), 1);
+	}
 
-	unsigned int arr_idx = 0;
-	Vector2 door_pos(0, 0);
-	// random link last (tile_count - 1) tile
-	for(unsigned int i = 1; i < tile_count; ++i) {
-		unsigned int src_door_idx = m_random.GetRand(0, m_open_doors.size() - 1);	
-		arr_idx = FindArrange(m_open_doors[src_door_idx].locate);
-		tile = ChooseLinkTile();
-		unsigned int dst_door_idx = m_random.GetRand(0, tile->m_doors.size() - 1);
-		GenNewLocate(&m_open_doors[src_door_idx], &tile->m_doors[dst_door_idx], door_pos, coord, loca_mode);
-		if (CheckTile(tile, coord, loca_mode)) {
-			AddLink(m_open_doors[src_door_idx].locate, door_pos);
-			DelDoor(src_door_idx);
-			AddDoors(tile, coord, loca_mode, dst_door_idx);
-			LinkTile(arr_idx, tile, coord, loca_mode);
+	BatchResultVec results;
+	std::vector<unsigned long long> hashes(count);
+	cout<<setw(10)<<"threads"<<setw(16)<<"dungeons/s"<<setw(12)<<"speedup"<<setw(20)<<"checksum"<<endl;
+	IndexVec thread_counts;
+	for (unsigned int threads = 1; threads < max_threads; threads *= 2) {
+		thread_counts.push_back(threads);
+	}
+	thread_counts.push_back(max_threads);
+
+	double base_rate = 0.0;
+	for (unsigned int n = 0; n < thread_counts.size(); ++n) {
+		unsigned int threads = thread_counts[n];
+		double start = GetTimeMs();
+		GenerateBatch(count, tile_count, base_seed, threads, catalog, results, [&](unsigned int index, const Graph &graph) {
+			hashes[index] = graph.GetLayoutHash();
+		});
+		double t = GetTimeMs() - start;
+
+		unsigned long long checksum = 0;
+		for (unsigned int i = 0; i < count; ++i) {
+			checksum = checksum * 31 + hashes[i];
 		}
-		else{
-			bool linked = false;
-			for (unsigned int d = 0; d < m_open_doors.size(); ++d) {
-				for (unsigned int k = 0; k < tile->m_doors.size(); ++k) {
-					arr_idx = FindArrange(m_open_doors[d].locate);
-					GenNewLocate(&m_open_doors[d], &tile->m_doors[k], door_pos, coord, loca_mode);
-					if (CheckTile(tile, coord, loca_mode)) {
-						linked = true;
-						AddLink(m_open_doors[d].locate, door_pos);
-						DelDoor(d);
-						AddDoors(tile, coord, loca_mode, k);
-						LinkTile(arr_idx, tile, coord, loca_mode);
-						break;
+		double rate = count * 1000.0 / t;
+		if (threads == 1) {
+			base_rate = rate;
+		}
+		cout<<setw(10)<<threads<<setw(16)<<rate<<setw(12)<<rate / base_rate<<setw(20)<<hex<<checksum<<dec<<endl;
+	}
+}
+
+// candidate evaluation through the runtime path (LocateNewTile, CheckTile, CheckCorridor), FitNewTile
+// and TestDoorBatch, over every combination at every open door left by RandomGen. All three must agree
+// on every candidate
+void BenchLocate()
+{
+	Graph graph;
+	const unsigned int counts[] = { 50, 200, 800 };
+	const unsigned int rounds = 20, repeats = 20;
+	cout<<setw(12)<<"tile_count"<<setw(14)<<"candidates"<<setw(16)<<"ns/runtime"<<setw(16)<<"ns/kernel"<<setw(16)<<"ns/batch"<<endl;
+	unsigned int bad = 0;
+	CandidateBatch batch;
+	for (unsigned int c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+		double runtime_time = 0.0, kernel_time = 0.0, batch_time = 0.0;
+		unsigned long long candidates = 0;
+		for (unsigned int r = 0; r < rounds; ++r) {
+			graph.Reset();
+			graph.RandomGen(counts[c], GetBatchSeed(counts[c], r));
+			// so that a batch holds every combination, as the list below does
+			for (unsigned int d = 0; d < graph.m_open_doors.size(); ++d) {
+				graph.m_frontier.Revive(d);
+			}
+
+			struct Candidate{
+				const Door *door;
+				const Tile *tile;
+				unsigned int dst_door_idx, combo;
+			};
+			std::vector<Candidate> list;
+			for (unsigned int d = 0; d < graph.m_open_doors.size(); ++d) {
+				for (unsigned int b = 0; b < MaxDoorCount; ++b) {
+					for (unsigned int t = 0; t < graph.m_catalog->GetBucket(b).size(); ++t) {
+						const Tile *tile = graph.m_catalog->GetBucket(b)[t];
+						for (unsigned int k = 0; k < tile->GetDoorCount(); ++k) {
+							for (unsigned int combo = 0; combo < graph.m_corridor_length * 2; ++combo) {
+								Candidate candidate = { &graph.m_open_doors[d], tile, k, combo };
+								list.push_back(candidate);
+							}
+						}
+					}
+				}
+			}
+			candidates += (unsigned long long)list.size() * repeats;
+
+			Vector2 door_pos, coord;
+			LocateMode loca_mode = Rotate0;
+			std::vector<char> fits(list.size());
+			double start = GetTimeMs();
+			for (unsigned int n = 0; n < repeats; ++n) {
+				for (unsigned int i = 0; i < list.size(); ++i) {
+					const Candidate &candidate = list[i];
+					graph.LocateNewTile(candidate.door, candidate.tile, candidate.dst_door_idx, candidate.combo / 2 + 1, candidate.combo % 2,
+						door_pos, coord, loca_mode);
+					fits[i] = graph.CheckTile(candidate.tile, coord, loca_mode) && graph.CheckCorridor(candidate.door->locate, door_pos);
+				}
+			}
+			runtime_time += GetTimeMs() - start;
+
+			unsigned int fit_count = 0;
+			start = GetTimeMs();
+			for (unsigned int n = 0; n < repeats; ++n) {
+				for (unsigned int i = 0; i < list.size(); ++i) {
+					const Candidate &candidate = list[i];
+					fit_count += graph.FitNewTile(candidate.door, candidate.tile, candidate.dst_door_idx, candidate.combo,
+						door_pos, coord, loca_mode) ? 1 : 0;
+				}
+			}
+			kernel_time += GetTimeMs() - start;
+
+			// the same candidates in the same order, a batch per door and tile
+			unsigned int batch_count = 0;
+			start = GetTimeMs();
+			for (unsigned int n = 0; n < repeats; ++n) {
+				for (unsigned int d = 0; d < graph.m_open_doors.size(); ++d) {
+					for (unsigned int b = 0; b < MaxDoorCount; ++b) {
+						for (unsigned int t = 0; t < graph.m_catalog->GetBucket(b).size(); ++t) {
+							batch_count += graph.TestDoorBatch(d, graph.m_catalog->GetBucket(b)[t], batch);
+						}
 					}
 				}
-				if (linked) {
-					break;
+			}
+			batch_time += GetTimeMs() - start;
+			unsigned int i = 0;
+			for (unsigned int d = 0; d < graph.m_open_doors.size(); ++d) {
+				for (unsigned int b = 0; b < MaxDoorCount; ++b) {
+					for (unsigned int t = 0; t < graph.m_catalog->GetBucket(b).size(); ++t) {
+						graph.TestDoorBatch(d, graph.m_catalog->GetBucket(b)[t], batch);
+						for (unsigned int n = 0; n < batch.count; ++n, ++i) {
+							bad += batch.fits[n] == (fits[i] != 0) ? 0 : 1;
+						}
+					}
 				}
 			}
+			bad += i == list.size() && batch_count == fit_count ? 0 : 1;
+
+			unsigned int runtime_count = 0;
+			for (unsigned int i = 0; i < list.size(); ++i) {
+				const Candidate &candidate = list[i];
+				Vector2 kernel_pos, kernel_coord;
+				LocateMode kernel_mode = Rotate0;
+				bool fit = graph.FitNewTile(candidate.door, candidate.tile, candidate.dst_door_idx, candidate.combo,
+					kernel_pos, kernel_coord, kernel_mode);
+				graph.LocateNewTile(candidate.door, candidate.tile, candidate.dst_door_idx, candidate.combo / 2 + 1, candidate.combo % 2,
+					door_pos, coord, loca_mode);
+				bad += fit == (fits[i] != 0) && kernel_pos == door_pos && kernel_coord == coord && kernel_mode == loca_mode ? 0 : 1;
+				runtime_count += fits[i] ? 1 : 0;
+			}
+			bad += fit_count == runtime_count * repeats ? 0 : 1;
 		}
+		cout<<setw(12)<<counts[c]<<setw(14)<<candidates<<setw(16)<<runtime_time * 1e6 / candidates
+			<<setw(16)<<kernel_time * 1e6 / candidates<<setw(16)<<batch_time * 1e6 / candidates<<endl;
 	}
+	cout<<"candidates the paths disagree on: "<<bad<<endl;
+}
 
-	// link end tile to the door or just close it
-	for (unsigned int i = 0; i < m_open_doors.size(); ++i) {
-		arr_idx = FindArrange(m_open_doors[i].locate);
-		tile = ChooseEndTile();
-		GenNewLocate(&m_open_doors[i], &tile->m_doors[0], door_pos, coord, loca_mode);
-		bool ok = CheckTile(tile, coord, loca_mode);
-		if (ok && m_cur_tile_count < tile_count) {
-			AddLink(m_open_doors[i].locate, door_pos);
-			DelDoor(i);
-			LinkTile(arr_idx, tile, coord, loca_mode);
+// time and memory of the layout storage at 1k, 100k and 1M rooms. The rooms are laid out
+// on a serpentine around the origin (so coordinates go negative) and chained one to the next,
+// since RandomGen with the built-in tiles walls itself in after a few thousand rooms. False when
+// a room of the chain overlaps another or the path through the chain misses a room
+bool BenchScale()
+{
+	const unsigned int counts[] = { 1000, 100000, 1000000 };
+	const int spacing = MaxTileSize + 2;
+	cout<<setw(10)<<"rooms"<<setw(14)<<"place ms"<<setw(14)<<"ns/room"<<setw(14)<<"compact ms"
+		<<setw(14)<<"path ms"<<setw(14)<<"MB"<<setw(14)<<"bytes/room"<<endl;
+	bool ok = true;
+	for (unsigned int c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+		const unsigned int n = counts[c];
+		Graph graph;
+		graph.Reset();
+		const Tile *tile = graph.m_catalog->GetBucket(1)[0];
+		const int side = (int)ceil(sqrt((double)n));
+
+		double start = GetTimeMs();
+		unsigned int rejected = 0;
+		for (unsigned int i = 0; i < n; ++i) {
+			int row = i / side, col = i % side;
+			if (row % 2 == 1) {
+				col = side - 1 - col;
+			}
+			Vector2 coord((row - side / 2) * spacing, (col - side / 2) * spacing);
+			rejected += graph.CheckTile(tile, coord, Rotate0) ? 0 : 1;
+			graph.LinkTile(i == 0 ? InvalidIndex : i - 1, tile, coord, Rotate0);
 		}
-	}
+		double place_time = GetTimeMs() - start;
 
-	return m_cur_tile_count == tile_count;
+		start = GetTimeMs();
+		graph.m_adj_list.Compact(graph.m_arranges.Size());
+		double compact_time = GetTimeMs() - start;
+
+		IndexVec path;
+		start = GetTimeMs();
+		graph.FindPath(0, n - 1, path);
+		double path_time = GetTimeMs() - start;
+		bool valid = rejected == 0 && path.size() == n;
+		ok = ok && valid;
 
+		size_t bytes = graph.GetMemoryUsage();
+		cout<<setw(10)<<n<<setw(14)<<place_time<<setw(14)<<place_time * 1e6 / n<<setw(14)<<compact_time
+			<<setw(14)<<path_time<<setw(14)<<bytes / (1024.0 * 1024.0)<<setw(14)<<bytes / n<<(valid ? "" : "  INVALID")<<endl;
+	}
+
+	Graph graph;
+	graph.Reset();
+	double start = GetTimeMs();
+	graph.RandomGen(1000, 1);
+	cout<<"RandomGen(1000): "<<graph.GetTileCount()<<" rooms in "<<GetTimeMs() - start<<" ms, "
+		<<graph.GetMemoryUsage() / graph.GetTileCount()<<" bytes/room"<<endl;
+	return ok;
 }
 
-bool Graph::GenExact(unsigned int tile_count, unsigned int max_try)
+// the generate/reset cycle of a warmed up Graph must not allocate,
+// only meaningful when built with COUNT_ALLOCATIONS defined (the roguelike_alloc target)
+bool CheckAllocations()
 {
-	bool ok = false;
-	for (unsigned int i = 0; i < max_try && (!ok); ++i) {
-		Reset();
-		ok |= RandomGen(tile_count);
+#ifdef COUNT_ALLOCATIONS
+	const unsigned int counts[] = { 22, 100, 200 };
+	const unsigned int rounds = 1000;
+	Graph graph;
+	graph.Seed(1);
+	for (unsigned int i = 0; i < 10; ++i) {
+		graph.GenExact(200);
+	}
+
+	bool ok = true;
+	for (unsigned int c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+		unsigned long long before = g_alloc_count;
+		for (unsigned int i = 0; i < rounds; ++i) {
+			graph.GenExact(counts[c]);
+		}
+		unsigned long long allocs = g_alloc_count - before;
+		cout<<"tile_count "<<counts[c]<<": "<<allocs<<" allocations in "<<rounds<<" GenExact calls"<<endl;
+		ok = ok && allocs == 0;
 	}
 	return ok;
+#else
+	cout<<"built without COUNT_ALLOCATIONS, nothing to check"<<endl;
+	return true;
+#endif
 }
 
-void Graph::FindPath(unsigned int start_idx, unsigned int end_idx, IndexVec &path)
+// walks a query point far out and back through a chunked world. The resident chunk count
+// must stay bounded and every revisited chunk must regenerate with the same layout hash
+void BenchWorld(unsigned int steps)
+{
+	ChunkedWorld world(20121001, 1);
+	std::map<unsigned long long, unsigned long long> first_hashes;
+	unsigned int max_resident = 0, mismatches = 0, revisits = 0;
+	size_t max_bytes = 0;
+	double gen_time = 0.0;
+	for (unsigned int i = 0; i <= 2 * steps; ++i) {
+		// out along a diagonal and back the same way, so every chunk is visited twice
+		int t = i <= steps ? i : 2 * steps - i;
+		Vector2 pos(t * ChunkSize / 2, t * ChunkSize / 3);
+		unsigned int generated = world.GetGeneratedCount();
+		double start = GetTimeMs();
+		world.Update(pos);
+		gen_time += GetTimeMs() - start;
+
+		int cx = ChunkedWorld::GetChunkCoord(pos.x), cy = ChunkedWorld::GetChunkCoord(pos.y);
+		for (int x = cx - 1; x <= cx + 1; ++x) {
+			for (int y = cy - 1; y <= cy + 1; ++y) {
+				const Chunk *chunk = world.GetChunk(x, y);
+				unsigned long long key = ((unsigned long long)(unsigned int)x << 32) | (unsigned int)y;
+				std::map<unsigned long long, unsigned long long>::iterator itr = first_hashes.find(key);
+				if (itr == first_hashes.end()) {
+					first_hashes[key] = chunk->hash;
+				}
+				else if (world.GetGeneratedCount() > generated && itr->second != chunk->hash) {
+					++mismatches;
+				}
+			}
+		}
+		revisits += world.GetGeneratedCount() - generated;
+		max_resident = std::max(max_resident, world.GetChunkCount());
+		max_bytes = std::max(max_bytes, world.GetMemoryUsage());
+	}
+	revisits -= first_hashes.size();
+
+	cout<<"chunks generated: "<<world.GetGeneratedCount()<<" ("<<first_hashes.size()<<" distinct, "<<revisits<<" regenerated)"<<endl;
+	cout<<"ms per chunk: "<<gen_time / world.GetGeneratedCount()<<endl;
+	cout<<"max resident chunks: "<<max_resident<<", max bytes: "<<max_bytes<<endl;
+	cout<<"regenerated chunks that differ: "<<mismatches<<endl;
+}
+
+// summary of the timed samples of one benchmark case
+struct BenchStats{
+	std::string name;
+	unsigned int tile_count;
+	unsigned int samples;
+	double mean, median, p95, p99;	// milliseconds per sample
+	double rooms_per_sec;
+};
+
+typedef std::vector<BenchStats> BenchStatsVec;
+
+// nearest rank percentile of sorted samples
+double GetPercentile(const std::vector<double> &sorted, double q)
 {
-	unsigned int d[MaxTileCount]; // d[i] Դڵ㵽ڵi̾
-	unsigned int p[MaxTileCount]; // p[i]: Դڵ㵽ڵi·ϣڵiǰһڵ
-	bitset<MaxTileCount> vset;
+	size_t rank = (size_t)ceil(q * sorted.size());
+	return sorted[rank > 0 ? rank - 1 : 0];
+}
 
-	const unsigned int nv = m_arranges.size();
-	queue<unsigned int> Q;
+// runs "fn" warmup times untimed, then times it "samples" times one call at a time,
+// fn returns the rooms it generated or processed
+BenchStats RunBenchCase(const char *name, unsigned int tile_count, unsigned int warmup, unsigned int samples,
+						const std::function<unsigned int()> &fn)
+{
+	for (unsigned int i = 0; i < warmup; ++i) {
+		fn();
+	}
 
-	unsigned int u_idx, v_idx;
-	for(unsigned int i = 0; i< nv; ++i) {
-		d[i] = INF;
-		p[i] = -1;
+	std::vector<double> times(samples);
+	double total = 0.0;
+	unsigned long long rooms = 0;
+	for (unsigned int i = 0; i < samples; ++i) {
+		double start = GetTimeMs();
+		rooms += fn();
+		times[i] = GetTimeMs() - start;
+		total += times[i];
 	}
-	d[start_idx] = 0;
-	vset.reset();
-	while(!Q.empty()) {
-		Q.pop();
-	}
-	Q.push(start_idx);
-	while(!Q.empty()) {
-		u_idx = Q.front();
-		Q.pop();
-		for(unsigned int i = 0; i < m_adj_list[u_idx].size(); ++i) {
-			v_idx = m_adj_list[u_idx][i];
-			if(d[u_idx] != INF && d[v_idx] > d[u_idx] + 1) {
-				d[v_idx] = d[u_idx] + 1;
-				p[v_idx] = u_idx;
-				if(!vset[v_idx]) {
-					vset.set(v_idx);
-					Q.push(v_idx);
-				}
+	std::sort(times.begin(), times.end());
+
+	BenchStats stats;
+	stats.name = name;
+	stats.tile_count = tile_count;
+	stats.samples = samples;
+	stats.mean = total / samples;
+	stats.median = GetPercentile(times, 0.5);
+	stats.p95 = GetPercentile(times, 0.95);
+	stats.p99 = GetPercentile(times, 0.99);
+	stats.rooms_per_sec = total > 0.0 ? rooms * 1000.0 / total : 0.0;
+	return stats;
+}
+
+// swallows everything, Print is timed without the cost of a terminal
+class NullBuffer : public std::streambuf{
+protected:
+	virtual int overflow(int c) { return traits_type::not_eof(c); }
+	virtual std::streamsize xsputn(const char*, std::streamsize n) { return n; }
+};
+
+// every export format of growing layouts into a null stream, whole in one write and streamed in 64 row
+// bands with 1 MB writes. "path" gets the exports of the largest layout for a look, unless it is NULL
+void BenchExport(const char *path)
+{
+	const unsigned int counts[] = { 100, 1000, 10000 };
+	const char *names[ExportFormatCount] = { "ascii", "pgm", "ppm", "json" };
+	const char *suffixes[ExportFormatCount] = { ".txt", ".pgm", ".ppm", ".json" };
+	NullBuffer null_buffer;
+	std::ostream null_out(&null_buffer);
+	MapExporter exporter;
+	cout<<setw(10)<<"rooms"<<setw(10)<<"format"<<setw(14)<<"MB"<<setw(14)<<"ms/write"<<setw(14)<<"ms/stream"<<setw(14)<<"stream KB"<<endl;
+	for (unsigned int c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+		Graph graph;
+		graph.Seed(counts[c]);
+		graph.GenExact(counts[c]);
+		for (unsigned int f = 0; f < ExportFormatCount; ++f) {
+			std::ostringstream whole, streamed;
+			exporter.Write(graph, (ExportFormat)f, whole);
+			exporter.Stream(graph, (ExportFormat)f, streamed);
+			bool same = whole.str() == streamed.str();
+
+			MapExporter fresh;
+			double start = GetTimeMs();
+			fresh.Write(graph, (ExportFormat)f, null_out);
+			double write_time = GetTimeMs() - start;
+			start = GetTimeMs();
+			exporter.Stream(graph, (ExportFormat)f, null_out);
+			double stream_time = GetTimeMs() - start;
+
+			MapExporter bounded;
+			bounded.Stream(graph, (ExportFormat)f, null_out);
+			cout<<setw(10)<<graph.GetTileCount()<<setw(10)<<names[f]<<setw(14)<<whole.str().size() / (1024.0 * 1024.0)
+				<<setw(14)<<write_time<<setw(14)<<stream_time<<setw(14)<<bounded.GetMemoryUsage() / 1024.0
+				<<(same ? "" : "  MISMATCH")<<endl;
+			if (path != NULL && c + 1 == sizeof(counts) / sizeof(counts[0])) {
+				std::ofstream out((std::string(path) + suffixes[f]).c_str(), std::ios::binary);
+				exporter.Write(graph, (ExportFormat)f, out);
 			}
 		}
 	}
+}
 
-	path.clear();
-	unsigned int idx = end_idx;
-	for (; idx != start_idx; idx = p[idx]) {
-		path.push_back(idx);
+// the regression suite: RandomGen, GenExact, FindPath, Rasterize and Print over a sweep of
+// tile counts with fixed seeds. Results go to stdout as a table and to "path" as JSON
+void BenchSuite(const char *path, unsigned int samples)
+{
+	const unsigned int counts[] = { 22, 50, 100, 200, 400 };
+	const unsigned int warmup = std::max(samples / 10, 1u);
+	const unsigned long long seed = 20121001;
+	BenchStatsVec results;
+	Graph graph;
+
+	for (unsigned int c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+		const unsigned int tile_count = counts[c];
+
+		graph.Seed(seed);
+		results.push_back(RunBenchCase("RandomGen", tile_count, warmup, samples, [&]() {
+			graph.Reset();
+			graph.RandomGen(tile_count);
+			return graph.GetTileCount();
+		}));
+
+		graph.Seed(seed);
+		results.push_back(RunBenchCase("GenExact", tile_count, warmup, samples, [&]() {
+			return graph.GenExact(tile_count) ? graph.GetTileCount() : 0;
+		}));
+
+		// the queries below run on one fixed layout
+		graph.Reset();
+		graph.RandomGen(tile_count, seed);
+		const unsigned int rooms = graph.GetTileCount();
+		IndexVec path_nodes;
+		Random random(seed);
+		results.push_back(RunBenchCase("FindPath", tile_count, warmup, samples, [&]() {
+			graph.FindPath(random.GetRand(0, rooms - 1), random.GetRand(0, rooms - 1), path_nodes);
+			return rooms;
+		}));
+
+		results.push_back(RunBenchCase("Rasterize", tile_count, warmup, samples, [&]() {
+			graph.Rasterize();
+			return rooms;
+		}));
+
+		NullBuffer null_buffer;
+		std::streambuf *cout_buffer = cout.rdbuf(&null_buffer);
+		BenchStats print_stats = RunBenchCase("Print", tile_count, warmup, samples, [&]() {
+			graph.Print();
+			return rooms;
+		});
+		cout.rdbuf(cout_buffer);
+		results.push_back(print_stats);
+	}
+
+	cout<<setw(12)<<"case"<<setw(8)<<"tiles"<<setw(12)<<"median ms"<<setw(12)<<"p95 ms"
+		<<setw(12)<<"p99 ms"<<setw(14)<<"rooms/s"<<endl;
+	for (unsigned int i = 0; i < results.size(); ++i) {
+		const BenchStats &r = results[i];
+		cout<<setw(12)<<r.name<<setw(8)<<r.tile_count<<setw(12)<<r.median<<setw(12)<<r.p95
+			<<setw(12)<<r.p99<<setw(14)<<(unsigned long long)r.rooms_per_sec<<endl;
+	}
+
+	std::ofstream out(path);
+	if (!out) {
+		cout<<"cannot write "<<path<<endl;
+		return;
 	}
-	path.push_back(start_idx);
-	unsigned int l = 0, r = path.size() - 1;
-	for (; l < r; ++l, --r) {
-		std::swap<unsigned int>(path[l], path[r]);
+	out<<"{\n  \"version\": 1,\n  \"samples\": "<<samples<<",\n  \"cases\": [\n";
+	for (unsigned int i = 0; i < results.size(); ++i) {
+		const BenchStats &r = results[i];
+		out<<"    {\"name\": \""<<r.name<<"\", \"tile_count\": "<<r.tile_count
+			<<", \"mean_ms\": "<<r.mean<<", \"median_ms\": "<<r.median<<", \"p95_ms\": "<<r.p95
+			<<", \"p99_ms\": "<<r.p99<<", \"rooms_per_sec\": "<<r.rooms_per_sec<<"}"
+			<<(i + 1 < results.size() ? ",\n" : "\n");
 	}
+	out<<"  ]\n}\n";
+	cout<<"results written to "<<path<<endl;
 }
 
-void Graph::Print()
+// FindPath by a BFS per query against the same queries on the all-pairs table,
+// false when the two disagree on a path
+bool BenchPaths(unsigned int queries)
 {
-	unsigned int h = MaxTileCount * MaxTileHeight;
-	unsigned int w = MaxTileCount * MaxTileWidth;
-	int left = w, right = 0, top = h, bottom = 0;
-	for (unsigned int i = 0; i < m_arranges.size(); ++i) {
-		Rect rect = m_arranges[i]->m_rect;
-		top = std::min<unsigned int>(top, rect.x);
-		bottom = std::max<unsigned int>(bottom, rect.x + rect.h);
-		left = std::min<unsigned int>(left, rect.y);
-		right = std::max<unsigned int>(right, rect.y + rect.w);
+	const unsigned int counts[] = { 100, 500, 1000, 4000 };
+	cout<<setw(10)<<"rooms"<<setw(14)<<"build ms"<<setw(14)<<"table MB"<<setw(14)<<"ns/bfs"<<setw(14)<<"ns/table"
+		<<setw(14)<<"break-even"<<endl;
+	IndexVec pairs, path;
+	bool ok = true;
+	for (unsigned int c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+		Graph graph;
+		graph.Seed(counts[c]);
+		graph.GenExact(counts[c]);
+		const unsigned int rooms = graph.GetTileCount();
+		Random random(counts[c]);
+		pairs.resize(queries * 2);
+		for (unsigned int i = 0; i < pairs.size(); ++i) {
+			pairs[i] = random.GetRand(0, rooms - 1);
+		}
+
+		unsigned long long bfs_sum = 0, table_sum = 0;
+		double start = GetTimeMs();
+		for (unsigned int i = 0; i < queries; ++i) {
+			graph.FindPath(pairs[i * 2], pairs[i * 2 + 1], path);
+			bfs_sum += path.size() * 31 + path[path.size() / 2];
+		}
+		double bfs_time = GetTimeMs() - start;
+
+		start = GetTimeMs();
+		graph.BuildDistances();
+		double build_time = GetTimeMs() - start;
+
+		start = GetTimeMs();
+		for (unsigned int i = 0; i < queries; ++i) {
+			graph.FindPath(pairs[i * 2], pairs[i * 2 + 1], path);
+			table_sum += path.size() * 31 + path[path.size() / 2];
+		}
+		double table_time = GetTimeMs() - start;
+		// a room graph is a tree, both find its one path
+		bool same = bfs_sum == table_sum;
+		ok = ok && same;
+
+		double bfs_query = bfs_time / queries, table_query = table_time / queries;
+		cout<<setw(10)<<rooms<<setw(14)<<build_time<<setw(14)<<graph.m_distances.GetMemoryUsage() / (1024.0 * 1024.0)
+			<<setw(14)<<bfs_query * 1e6<<setw(14)<<table_query * 1e6<<setw(14)<<(unsigned int)ceil(build_time / (bfs_query - table_query))
+			<<(same ? "" : "  MISMATCH")<<endl;
 	}
+	return ok;
+}
 
-	h = bottom - top + 1;
-	w = right - left + 1;
-	char **grids = new char*[h];
-	for (unsigned int i = 0; i < h; ++i) {
-		grids[i] = new char[w];
-		memset(grids[i], GridChar[GridUnused], sizeof(char) * w);
-	}
-
-	for (unsigned int a = 0; a < m_arranges.size(); ++a) {
-		Arrange arrange = *m_arranges[a];
-		unsigned int nw = arrange.m_tile->m_width;
-		unsigned int nh = arrange.m_tile->m_height;
-		for (unsigned int i = 0; i < nh; ++i) {
-			for (unsigned int j = 0; j < nw; ++j) {
-				unsigned int x = 0, y = 0;
-				unsigned int u = 0, v = 0;
-				switch(arrange.m_locate)
-				{
-				case Rotate0:
-					x = arrange.m_rect.x + i - top;
-					y = arrange.m_rect.y + j - left;
-					u = i;
-					v = j;	
-					break;
-				case Rotate90:
-					x = arrange.m_rect.x + j - top;
-					y = arrange.m_rect.y + i - left;
-					u = nh - i - 1;
-					v = j;
-					break;
-				case Rotate180:
-					x = arrange.m_rect.x + i - top;
-					y = arrange.m_rect.y + j - left;
-					u = nh - i - 1;
-					v = nw - j - 1;
-					break;
-				case Rotate270:
-					x = arrange.m_rect.x + j - top;
-					y = arrange.m_rect.y + i - left;
-					u = i;
-					v = nw - j - 1;
-					break;
-				case HoriMirror:
-					x = arrange.m_rect.x + i - top;
-					y = arrange.m_rect.y + j - left;
-					u = i;
-					v = nw - j - 1;
-					break;
-				case VertMirror:
-					x = arrange.m_rect.x + i - top;
-					y = arrange.m_rect.y + j - left;
-					u = nh - i - 1;
-					v = j;
-					break;
-				default:
-					break;
-				}
+// opening a saved layout against regenerating it from its seed. "open" maps and checks the
+// header and the room graph, "verified" also checksums the payload, "walk" reads every room and neighbour.
+// False when a layout cannot be saved, does not regenerate from its seed or reads back different
+bool BenchLoad(const char *path, unsigned int rounds)
+{
+	const unsigned int counts[] = { 100, 1000, 4000, 10000 };
+	cout<<setw(10)<<"rooms"<<setw(14)<<"file KB"<<setw(14)<<"ms/regen"<<setw(14)<<"ms/open"<<setw(14)<<"ms/verified"
+		<<setw(14)<<"ms/walk"<<endl;
+	bool ok = true;
+	for (unsigned int c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+		Graph graph;
+		graph.Seed(counts[c]);
+		if (!graph.GenExact(counts[c]) || !graph.Save(path)) {
+			cout<<setw(10)<<counts[c]<<"  failed"<<endl;
+			ok = false;
+			continue;
+		}
+		const unsigned long long hash = graph.GetLayoutHash();
+
+		double start = GetTimeMs();
+		for (unsigned int r = 0; r < rounds; ++r) {
+			graph.Seed(counts[c]);
+			graph.GenExact(counts[c]);
+		}
+		double regen_time = GetTimeMs() - start;
+		const bool regenerated = graph.GetLayoutHash() == hash;
+
+		DungeonView view;
+		start = GetTimeMs();
+		for (unsigned int r = 0; r < rounds; ++r) {
+			view.Open(path, false);
+		}
+		double open_time = GetTimeMs() - start;
+
+		start = GetTimeMs();
+		for (unsigned int r = 0; r < rounds; ++r) {
+			view.Open(path);
+		}
+		double verified_time = GetTimeMs() - start;
 
-				if(i + j == 0) grids[x][y] = 'A' + a;
-				else grids[x][y] = arrange.m_tile->m_grids[u][v];
+		unsigned long long sum = 0;
+		start = GetTimeMs();
+		for (unsigned int r = 0; r < rounds && view.Open(path); ++r) {
+			for (unsigned int i = 0; i < view.GetRoomCount(); ++i) {
+				sum += view.GetRoom(i).x + view.GetRoom(i).tile_id;
+				for (unsigned int k = 0; k < view.GetDegree(i); ++k) {
+					sum += view.GetNeighbors(i)[k];
+				}
 			}
 		}
+		double walk_time = GetTimeMs() - start;
+
+		// the view must hold the layout the graph has
+		bool same = regenerated && sum > 0 && view.IsOpen() && view.GetLayoutHash() == hash && view.GetSeed() == graph.GetSeed()
+			&& view.GetRoomCount() == graph.GetTileCount() && view.GetCorridorCount() == graph.GetLines().size();
+		for (unsigned int i = 0; same && i < view.GetRoomCount(); ++i) {
+			Arrange arrange = graph.GetArranges()[i];
+			const DungeonFileRoom &room = view.GetRoom(i);
+			same = room.x == arrange.m_rect.x && room.y == arrange.m_rect.y && room.pivot_x == arrange.m_pivot.x
+				&& room.locate == (unsigned int)arrange.m_locate && view.GetDegree(i) == graph.GetRoomGraph().GetDegree(i)
+				&& memcmp(view.GetNeighbors(i), graph.GetRoomGraph().GetNeighbors(i), view.GetDegree(i) * sizeof(unsigned int)) == 0;
+		}
+		ok = ok && same;
+
+		cout<<setw(10)<<(view.IsOpen() ? view.GetRoomCount() : 0)<<setw(14)<<view.GetFileSize() / 1024.0
+			<<setw(14)<<regen_time / rounds<<setw(14)<<open_time / rounds<<setw(14)<<verified_time / rounds
+			<<setw(14)<<walk_time / rounds<<(same ? "" : "  MISMATCH")<<endl;
 	}
+	remove(path);
+	return ok;
+}
 
-	for (unsigned int i = 0; i < m_lines.size(); ++i)
-	{
-		if (m_lines[i].start.x == m_lines[i].end.x)
-		{
-			int x = m_lines[i].start.x;
-			int len = std::abs(m_lines[i].start.y - m_lines[i].end.y) + 1;
-			int ymin = std::min<int>(m_lines[i].start.y, m_lines[i].end.y);
-			for (int j = 0; j < len; ++j)
-			{
-				int y = ymin + j;
-				grids[x - top][y - left] = 'd';
+// bytes per room of a layout packed as a CompactLayout against the copies a Level or Chunk keeps and the
+// working Graph, with the cost of encoding, decoding back into a Graph and reading one room at random.
+// False when a layout does not come back the same
+bool BenchCompact(unsigned int layouts)
+{
+	const unsigned int counts[] = { 100, 1000, 10000 };
+	cout<<setw(10)<<"rooms"<<setw(14)<<"graph B/room"<<setw(14)<<"level B/room"<<setw(14)<<"packed B/room"
+		<<setw(14)<<"us/encode"<<setw(14)<<"us/decode"<<setw(14)<<"ns/room read"<<setw(14)<<"same layout"<<endl;
+	Graph graph, decoded;
+	std::vector<Arrange> rooms;
+	LineVec lines;
+	IndexVec edges;
+	std::vector<CompactLayout> compacts(layouts);
+	bool all_same = true;
+	for (unsigned int c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+		size_t graph_bytes = 0, level_bytes = 0, compact_bytes = 0;
+		unsigned long long room_count = 0;
+		double encode_time = 0.0, decode_time = 0.0, read_time = 0.0;
+		unsigned long long sum = 0;
+		unsigned int reads = 0;
+		bool same = true;
+		for (unsigned int n = 0; n < layouts; ++n) {
+			graph.Seed(GetBatchSeed(counts[c], n));
+			graph.GenExact(counts[c]);
+			const unsigned int size = graph.GetArranges().Size();
+			room_count += size;
+			graph_bytes += graph.GetMemoryUsage();
+			CopyLayout(graph, rooms, lines, edges);
+			level_bytes += rooms.capacity() * sizeof(Arrange) + lines.capacity() * sizeof(Line) + edges.capacity() * sizeof(unsigned int);
+
+			double start = GetTimeMs();
+			bool ok = graph.Encode(compacts[n]);
+			encode_time += GetTimeMs() - start;
+			compact_bytes += compacts[n].GetMemoryUsage();
+
+			start = GetTimeMs();
+			ok = ok && decoded.Decode(compacts[n]);
+			decode_time += GetTimeMs() - start;
+
+			const RoomGraph &room_graph = graph.GetRoomGraph(), &decoded_graph = decoded.GetRoomGraph();
+			same = same && ok && decoded.GetLayoutHash() == graph.GetLayoutHash() && decoded_graph.GetEdgeCount() == room_graph.GetEdgeCount();
+			for (unsigned int i = 0; same && i < size; ++i) {
+				same = decoded_graph.GetDegree(i) == room_graph.GetDegree(i)
+					&& memcmp(decoded_graph.GetNeighbors(i), room_graph.GetNeighbors(i), room_graph.GetDegree(i) * sizeof(unsigned int)) == 0;
+			}
+
+			Random random(n);
+			start = GetTimeMs();
+			for (unsigned int k = 0; ok && k < 1000; ++k) {
+				CompactRoom room = compacts[n].GetRoom(random.GetRand(0, size - 1));
+				sum += room.pivot.x + room.parent;
+			}
+			read_time += GetTimeMs() - start;
+			reads += ok ? 1000 : 0;
+			for (unsigned int k = 0; same && k < 100; ++k) {
+				unsigned int i = random.GetRand(0, size - 1);
+				CompactRoom room = compacts[n].GetRoom(i);
+				Arrange arrange = graph.GetArranges()[i];
+				same = room.pivot == arrange.m_pivot && room.locate == arrange.m_locate && room.type_id == arrange.m_tile->GetTypeId();
 			}
 		}
-		else if (m_lines[i].start.y == m_lines[i].end.y)
-		{
-			int y = m_lines[i].start.y;
-			int len = std::abs(m_lines[i].start.x - m_lines[i].end.x) + 1;
-			int xmin = std::min<int>(m_lines[i].start.x, m_lines[i].end.x);
-			for (int j = 0; j < len; ++j)
-			{
-				int x = xmin + j;
-				grids[x - top][y - left] = 'd';
+		same = same && (layouts == 0 || sum > 0);
+		all_same = all_same && same;
+		cout<<setw(10)<<counts[c]<<setw(14)<<(double)graph_bytes / room_count<<setw(14)<<(double)level_bytes / room_count
+			<<setw(14)<<(double)compact_bytes / room_count<<setw(14)<<encode_time * 1000.0 / layouts
+			<<setw(14)<<decode_time * 1000.0 / layouts<<setw(14)<<(reads > 0 ? read_time * 1e6 / reads : 0.0)
+			<<setw(14)<<(same ? "yes" : "NO")<<endl;
+	}
+	return all_same;
+}
+
+// the same seeds under a few tile mixes: cost per exact dungeon, how often the first RandomGen already
+// had every room, and the share of dead end (1 neighbour) and hub (3 or more) rooms. The built-in
+// tiles all have the same size, with "dir" the tiles come from its definition files instead
+void BenchTileMix(unsigned int count, const char *dir)
+{
+	const unsigned int tile_count = 100;
+	const char *names[] = { "default", "hubs", "dead ends", "small rooms", "large rooms" };
+	TileMix mixes[5];
+	mixes[1].door_shares[1] = 0.3;
+	mixes[1].door_shares[2] = mixes[1].door_shares[3] = 3.0;
+	mixes[2].door_shares[0] = 0.3;
+	mixes[3].area_power = -3.0;
+	mixes[4].area_power = 3.0;
+	cout<<setw(14)<<"mix"<<setw(14)<<"ms/dungeon"<<setw(14)<<"first try"<<setw(14)<<"dead ends"<<setw(14)<<"hubs"<<endl;
+	Graph graph;
+	if (dir != NULL && !graph.LoadTiles(dir)) {
+		return;
+	}
+	for (unsigned int m = 0; m < sizeof(mixes) / sizeof(mixes[0]); ++m) {
+		graph.SetTileMix(mixes[m]);
+		unsigned int first_try = 0, dead_ends = 0, hubs = 0, rooms = 0;
+		double start = GetTimeMs();
+		for (unsigned int i = 0; i < count; ++i) {
+			graph.Seed(i);
+			graph.GenExact(tile_count);
+			first_try += graph.GetAttempts() == 1 ? 1 : 0;
+			const RoomGraph &adj = graph.GetRoomGraph();
+			for (unsigned int r = 0; r < adj.GetNodeCount(); ++r) {
+				dead_ends += adj.GetDegree(r) == 1 ? 1 : 0;
+				hubs += adj.GetDegree(r) >= 3 ? 1 : 0;
 			}
+			rooms += adj.GetNodeCount();
 		}
+		double time = GetTimeMs() - start;
+		cout<<setw(14)<<names[m]<<setw(14)<<time / count<<setw(13)<<first_try * 100.0 / count<<"%"
+			<<setw(13)<<dead_ends * 100.0 / rooms<<"%"<<setw(13)<<hubs * 100.0 / rooms<<"%"<<endl;
 	}
+}
 
-	cout<<m_cur_tile_count<<endl;
-	cout<<setw(5)<<" ";
-	for (unsigned int i = 0; i < w; ++i) {
-		char c = 'A' + (i % 26);
-		cout<<c;
+// writes "count" tiles with ids from "first_id" as a tile definition file, plain rooms of random
+// size, each with 1 to MaxDoorCount doors on different sides
+bool WriteBenchTiles(const std::string &path, unsigned int first_id, unsigned int count, Random &random)
+{
+	std::ofstream out(path.c_str());
+	for (unsigned int t = 0; t < count; ++t) {
+		unsigned int h = random.GetRand(5, MaxTileHeight), w = random.GetRand(5, MaxTileWidth);
+		std::vector<std::string> rows(h, std::string(w, '.'));
+		for (unsigned int i = 0; i < h; ++i) {
+			rows[i][0] = rows[i][w - 1] = 'x';
+		}
+		rows[0] = rows[h - 1] = std::string(w, 'x');
+		unsigned int sides[DoorDirectionCount] = { DoorUp, DoorDown, DoorLeft, DoorRight };
+		for (unsigned int k = DoorDirectionCount - 1; k > 0; --k) {
+			std::swap(sides[k], sides[random.GetRand(0, k)]);
+		}
+		for (unsigned int k = 0; k < (first_id + t) % MaxDoorCount + 1; ++k) {
+			unsigned int along = random.GetRand(1, (sides[k] < DoorLeft ? w : h) - 2);
+			switch (sides[k]) {
+			case DoorUp: rows[0][along] = 'd'; break;
+			case DoorDown: rows[h - 1][along] = 'd'; break;
+			case DoorLeft: rows[along][0] = 'd'; break;
+			default: rows[along][w - 1] = 'd'; break;
+			}
+		}
+		out<<"tile "<<first_id + t<<'\n';
+		for (unsigned int i = 0; i < h; ++i) {
+			out<<rows[i]<<'\n';
+		}
+		out<<'\n';
 	}
-	cout<<endl;
-	for (unsigned int i = 0; i < h; ++i) {
-		cout<<setw(5)<<i;
-		for (unsigned int j = 0; j < w; ++j) {
-			cout<<grids[i][j];
+	return (bool)out;
+}
+
+// startup cost of a tile library: parsing and baking the definition files, the same plus
+// writing the catalog, and mapping the catalog on a later start. Then the cost of one more
+// generator over the library once it is loaded. The bench files go to "dir" and are removed afterwards
+void BenchTileLoad(const char *dir, unsigned int rounds)
+{
+	const unsigned int counts[] = { 10, 100, 1000, 5000 };
+	const unsigned int per_file = 100;
+	const std::string cache = std::string(dir) + "/bench_tiles.catalog";
+	cout<<setw(10)<<"tiles"<<setw(14)<<"catalog KB"<<setw(14)<<"ms/parse"<<setw(14)<<"ms/compile"<<setw(14)<<"ms/mapped"
+		<<setw(14)<<"us/graph"<<setw(14)<<"same layout"<<endl;
+	Graph graph;
+	for (unsigned int c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+		Random random(counts[c]);
+		std::vector<std::string> paths;
+		bool ok = true;
+		for (unsigned int first = 0; first < counts[c]; first += per_file) {
+			char name[32];
+			snprintf(name, sizeof(name), "/bench_%04u.tile", first / per_file);
+			paths.push_back(std::string(dir) + name);
+			ok = ok && WriteBenchTiles(paths.back(), first, std::min(per_file, counts[c] - first), random);
 		}
-		cout<<endl;
+		remove(cache.c_str());
+
+		double start = GetTimeMs();
+		ok = ok && graph.LoadTiles(dir);
+		double parse_time = GetTimeMs() - start;
+		graph.Seed(counts[c]);
+		graph.GenExact(100);
+		unsigned long long hash = graph.GetLayoutHash();
+
+		start = GetTimeMs();
+		ok = ok && graph.LoadTiles(dir, cache.c_str());
+		double compile_time = GetTimeMs() - start;
+
+		start = GetTimeMs();
+		for (unsigned int r = 0; r < rounds && ok; ++r) {
+			ok = graph.LoadTiles(dir, cache.c_str());
+		}
+		double mapped_time = GetTimeMs() - start;
+		graph.Seed(counts[c]);
+		graph.GenExact(100);
+		bool same = graph.GetLayoutHash() == hash;
+
+		// it shares the catalog and only builds its TileMix tables
+		const unsigned int graphs = 1000;
+		start = GetTimeMs();
+		for (unsigned int r = 0; r < graphs && ok; ++r) {
+			Graph generator(graph.GetCatalog());
+			ok = generator.GetCatalog() == graph.GetCatalog();
+		}
+		double graph_time = GetTimeMs() - start;
+
+		std::ifstream catalog(cache.c_str(), std::ios::binary | std::ios::ate);
+		double catalog_kb = catalog ? (double)catalog.tellg() / 1024.0 : 0.0;
+		catalog.close();
+		for (unsigned int i = 0; i < paths.size(); ++i) {
+			remove(paths[i].c_str());
+		}
+		remove(cache.c_str());
+		if (!ok) {
+			cout<<setw(10)<<counts[c]<<"  failed"<<endl;
+			break;
+		}
+		cout<<setw(10)<<counts[c]<<setw(14)<<catalog_kb<<setw(14)<<parse_time<<setw(14)<<compile_time
+			<<setw(14)<<mapped_time / rounds<<setw(14)<<graph_time * 1000.0 / graphs<<setw(14)<<(same ? "yes" : "NO")<<endl;
 	}
-	cout<<endl;
+}
 
-	cout<<"adjacent matrix:"<<endl;
+// FindCellPath against a breadth first flood over the rasterized map, between random floor cells.
+// False when the cost, the walk and the tabled cost of FindCellPath disagree
+bool BenchCellPaths(unsigned int queries)
+{
+	static const int steps[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+	const unsigned int counts[] = { 100, 1000, 4000 };
+	cout<<setw(10)<<"rooms"<<setw(14)<<"build ms"<<setw(14)<<"us/cost"<<setw(14)<<"us/cells"<<setw(14)<<"us/tabled"
+		<<setw(14)<<"us/flood"<<setw(14)<<"same cost"<<endl;
+	std::vector<Vector2> ends, cells;
+	IndexVec dist, queue;
+	bool ok = true;
+	for (unsigned int c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+		Graph graph;
+		graph.Seed(counts[c]);
+		graph.GenExact(counts[c]);
+		const Raster &raster = graph.Rasterize();
+		Random random(counts[c]);
+		ends.clear();
+		// floor cells of the tiles, not of the raster, where a room label may read as floor
+		const ArrangeStore &arranges = graph.GetArranges();
+		while (ends.size() < queries * 2) {
+			unsigned int a = random.GetRand(0, arranges.Size() - 1);
+			const TileVariant &variant = arranges.GetTile(a)->GetVariant(arranges.GetLocate(a));
+			unsigned int x = random.GetRand(0, variant.m_height - 1), y = random.GetRand(0, variant.m_width - 1);
+			if (variant.GetGrid(x, y) == GridFloor) {
+				Rect rect = arranges.GetRect(a);
+				ends.push_back(Vector2(rect.x + x, rect.y + y));
+			}
+		}
 
-	if (m_arranges.size() <= 24) {
-		for (unsigned int i = 0; i < m_arranges.size(); ++i) {
-			cout<<"Node "<<(char)('A'+ i)<<"->";
-			for (unsigned int j = 0; j < m_adj_list[i].size(); ++j) {
-				cout<<(char)('A'+ m_adj_list[i][j]);
-				if (j + 1 < m_adj_list[i].size()) {
-					cout<<"->";
-				}
-				else {
-					cout<<endl;
+		double start = GetTimeMs();
+		graph.FindCellPath(ends[0], ends[1]);
+		double build_time = GetTimeMs() - start;
+
+		unsigned long long cost_sum = 0, cells_sum = 0, tabled_sum = 0;
+		start = GetTimeMs();
+		for (unsigned int i = 0; i < queries; ++i) {
+			cost_sum += graph.FindCellPath(ends[i * 2], ends[i * 2 + 1]);
+		}
+		double cost_time = GetTimeMs() - start;
+
+		start = GetTimeMs();
+		for (unsigned int i = 0; i < queries; ++i) {
+			graph.FindCellPath(ends[i * 2], ends[i * 2 + 1], &cells);
+			cells_sum += cells.size() - 1;
+		}
+		double cells_time = GetTimeMs() - start;
+
+		// with the room route from the all-pairs table instead of a room graph search
+		graph.BuildDistances();
+		start = GetTimeMs();
+		for (unsigned int i = 0; i < queries; ++i) {
+			tabled_sum += graph.FindCellPath(ends[i * 2], ends[i * 2 + 1]);
+		}
+		double tabled_time = GetTimeMs() - start;
+
+		// the flood may find a shorter walk through a door left open next to a corridor, which
+		// the room graph does not know about, so only count the agreements
+		const unsigned int w = raster.GetWidth(), size = raster.GetHeight() * w;
+		unsigned int same = 0;
+		start = GetTimeMs();
+		for (unsigned int i = 0; i < queries; ++i) {
+			dist.assign(size, INF);
+			queue.resize(size);
+			unsigned int from = (ends[i * 2].x - raster.GetTop()) * w + ends[i * 2].y - raster.GetLeft();
+			unsigned int to = (ends[i * 2 + 1].x - raster.GetTop()) * w + ends[i * 2 + 1].y - raster.GetLeft();
+			unsigned int head = 0, tail = 0;
+			dist[from] = 0;
+			queue[tail++] = from;
+			while (head < tail && dist[to] == INF) {
+				unsigned int cur = queue[head++];
+				int x = cur / w, y = cur % w;
+				for (unsigned int k = 0; k < 4; ++k) {
+					int nx = x + steps[k][0], ny = y + steps[k][1];
+					if (nx < 0 || ny < 0 || nx >= (int)raster.GetHeight() || ny >= (int)w) {
+						continue;
+					}
+					unsigned int next = nx * w + ny;
+					char grid = raster.GetRow(nx)[ny];
+					if ((grid == GridChar[GridFloor] || grid == GridChar[GridDoor]) && dist[next] == INF) {
+						dist[next] = dist[cur] + 1;
+						queue[tail++] = next;
+					}
 				}
 			}
+			same += dist[to] == graph.FindCellPath(ends[i * 2], ends[i * 2 + 1]) ? 1 : 0;
 		}
-		cout<<endl;
+		double flood_time = GetTimeMs() - start;
+		bool agree = cells_sum == cost_sum && tabled_sum == cost_sum;
+		ok = ok && agree;
+
+		cout<<setw(10)<<graph.GetTileCount()<<setw(14)<<build_time<<setw(14)<<cost_time * 1e3 / queries
+			<<setw(14)<<cells_time * 1e3 / queries<<setw(14)<<tabled_time * 1e3 / queries<<setw(14)<<flood_time * 1e3 / queries<<setw(13)<<same * 100.0 / queries<<"%"
+			<<(agree ? "" : "  MISMATCH")<<endl;
 	}
-	else{
-		for (unsigned int i = 0; i < m_arranges.size(); ++i) {
-			cout<<"Node "<<i<<"->";
-			for (unsigned int j = 0; j < m_adj_list[i].size(); ++j) {
-				cout<<m_adj_list[i][j];
-				if (j + 1 < m_adj_list[i].size()) {
-					cout<<"->";
-				}
-				else {
-					cout<<endl;
-				}
+	return ok;
+}
+
+// request latency of a LevelPool next to calling GenExact in place. "requests" levels are asked for
+// at a steady pace the stock keeps up with, then in one burst that drains it, so the burst shows the
+// on-demand fallback. Every level must match a fresh generation from its seed
+void BenchLevelPool(unsigned int requests, unsigned int threads)
+{
+	LevelConfig configs[3] = { LevelConfig(50), LevelConfig(100), LevelConfig(200) };
+	configs[1].mix.door_shares[2] = configs[1].mix.door_shares[3] = 3.0;
+	const unsigned int stocks[3] = { 16, 8, 4 };
+	const unsigned int config_count = sizeof(configs) / sizeof(configs[0]);
+
+	// the blocking baseline
+	Graph graph;
+	std::vector<double> times;
+	for (unsigned int i = 0; i < requests; ++i) {
+		const LevelConfig &config = configs[i % config_count];
+		graph.SetTileMix(config.mix);
+		graph.Seed(GetBatchSeed(7, i));
+		double start = GetTimeMs();
+		graph.GenExact(config.tile_count, config.max_rounds);
+		times.push_back(GetTimeMs() - start);
+	}
+	std::sort(times.begin(), times.end());
+	cout<<setw(12)<<"phase"<<setw(12)<<"requests"<<setw(12)<<"stocked"<<setw(12)<<"p50 us"<<setw(12)<<"p99 us"<<setw(12)<<"max us"<<endl;
+	cout<<setw(12)<<"GenExact"<<setw(12)<<requests<<setw(12)<<0<<setw(12)<<GetPercentile(times, 0.5) * 1000.0
+		<<setw(12)<<GetPercentile(times, 0.99) * 1000.0<<setw(12)<<times.back() * 1000.0<<endl;
+
+	LevelPool pool(threads);
+	IndexVec config_ids;
+	for (unsigned int c = 0; c < config_count; ++c) {
+		config_ids.push_back(pool.AddConfig(configs[c], stocks[c], 20121001 + c));
+	}
+	double start = GetTimeMs();
+	pool.WaitForStock();
+	cout<<pool.GetThreadCount()<<" pool threads stocked up in "<<GetTimeMs() - start<<" ms"<<endl;
+
+	std::vector<LevelPtr> levels;
+	const char *phases[] = { "paced", "burst" };
+	for (unsigned int phase = 0; phase < 2; ++phase) {
+		times.clear();
+		unsigned int stocked = 0;
+		for (unsigned int i = 0; i < requests; ++i) {
+			if (phase == 0) {
+				// about the time a player spends on a level, compressed, so the stock refills in between
+				std::this_thread::sleep_for(std::chrono::milliseconds(2));
 			}
+			start = GetTimeMs();
+			LevelPtr level = pool.Request(config_ids[i % config_count]).get();
+			times.push_back(GetTimeMs() - start);
+			stocked += level->stocked ? 1 : 0;
+			levels.push_back(level);
 		}
-		cout<<endl;
+		std::sort(times.begin(), times.end());
+		cout<<setw(12)<<phases[phase]<<setw(12)<<requests<<setw(12)<<stocked<<setw(12)<<GetPercentile(times, 0.5) * 1000.0
+			<<setw(12)<<GetPercentile(times, 0.99) * 1000.0<<setw(12)<<times.back() * 1000.0<<endl;
+		pool.WaitForStock();
+	}
+
+	// levels asked for by seed, taken from the stock when it has them and generated otherwise
+	unsigned int bad = 0;
+	const unsigned long long stock_seed = GetBatchSeed(20121001, 2 * requests);
+	unsigned int waiting = 0;
+	std::mutex lock;
+	std::condition_variable done;
+	const unsigned long long seeds[] = { stock_seed, 12345 };
+	for (unsigned int i = 0; i < 2; ++i) {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			++waiting;
+		}
+		pool.Request(config_ids[0], [&](const LevelPtr &level) {
+			std::lock_guard<std::mutex> guard(lock);
+			levels.push_back(level);
+			bad += level->seed == seeds[i] ? 0 : 1;
+			--waiting;
+			done.notify_all();
+		}, seeds[i]);
+		std::unique_lock<std::mutex> guard(lock);
+		while (waiting > 0) {
+			done.wait(guard);
+		}
+	}
+
+	for (unsigned int i = 0; i < levels.size(); ++i) {
+		const Level &level = *levels[i];
+		const LevelConfig &config = configs[level.config_id];
+		graph.SetTileMix(config.mix);
+		graph.Seed(level.seed);
+		bool ok = graph.GenExact(config.tile_count, config.max_rounds);
+		bad += ok == level.ok && graph.GetLayoutHash() == level.hash && graph.GetArranges().Size() == level.rooms.size() ? 0 : 1;
+	}
+	cout<<pool.GetServedFromStock()<<" served from stock, "<<pool.GetServedOnDemand()<<" on demand, "
+		<<levels.size()<<" levels checked against their seed, bad "<<bad<<endl;
+}
+
+// generation counters for a batch per tile count, for tuning MaxCorridorLength, max_rounds and the tile mix
+void PrintGenStats(unsigned int count, const TileCatalogPtr &catalog)
+{
+#ifdef GENERATION_STATS
+	const unsigned int counts[] = { 22, 50, 100, 200 };
+	BatchResultVec results;
+	for (unsigned int c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+		GenerateBatch(count, counts[c], 20121001, 0, catalog, results);
+		GenStats total;
+		for (unsigned int i = 0; i < results.size(); ++i) {
+			total.Add(results[i].stats);
+		}
+		cout<<"== tile_count "<<counts[c]<<", "<<count<<" dungeons"<<endl;
+		total.Print(cout);
+		cout<<"repair rounds per success: "<<(double)total.repair_rounds / std::max<unsigned long long>(total.exact_successes, 1)<<endl;
 	}
+#else
+	(void)count;
+	(void)catalog;
+	cout<<"built without GENERATION_STATS, nothing to report"<<endl;
+#endif
+}
 
+// the tiles of the definition files in "dir" for the batch modes, the built-in ones without a dir
+TileCatalogPtr LoadBenchCatalog(const char *dir)
+{
+	return dir != NULL ? TileCatalog::Load(dir) : TileCatalog::GetBuiltin();
 }
 
-int main()
+int main(int argc, char *argv[])
 {
+	if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+		BenchPlacement();
+		return 0;
+	}
+	if (argc > 1 && strcmp(argv[1], "suite") == 0) {
+		BenchSuite(argc > 2 ? argv[2] : "bench_results.json", argc > 3 ? atoi(argv[3]) : 200);
+		return 0;
+	}
+	if (argc > 1 && strcmp(argv[1], "stats") == 0) {
+		TileCatalogPtr catalog = LoadBenchCatalog(argc > 3 ? argv[3] : NULL);
+		if (catalog) {
+			PrintGenStats(argc > 2 ? atoi(argv[2]) : 1000, catalog);
+		}
+		return catalog ? 0 : 1;
+	}
+	if (argc > 1 && strcmp(argv[1], "paths") == 0) {
+		return BenchPaths(argc > 2 ? atoi(argv[2]) : 10000) ? 0 : 1;
+	}
+	if (argc > 1 && strcmp(argv[1], "cellpaths") == 0) {
+		return BenchCellPaths(argc > 2 ? atoi(argv[2]) : 1000) ? 0 : 1;
+	}
+	if (argc > 1 && strcmp(argv[1], "load") == 0) {
+		return BenchLoad(argc > 2 ? argv[2] : "bench_dungeon.bin", argc > 3 ? atoi(argv[3]) : 20) ? 0 : 1;
+	}
+	if (argc > 1 && strcmp(argv[1], "compact") == 0) {
+		return BenchCompact(argc > 2 ? atoi(argv[2]) : 20) ? 0 : 1;
+	}
+	if (argc > 1 && strcmp(argv[1], "locate") == 0) {
+		BenchLocate();
+		return 0;
+	}
+	if (argc > 1 && strcmp(argv[1], "levels") == 0) {
+		BenchLevelPool(argc > 2 ? atoi(argv[2]) : 300, argc > 3 ? atoi(argv[3]) : 0);
+		return 0;
+	}
+	if (argc > 1 && strcmp(argv[1], "sweep") == 0) {
+		TileCatalogPtr catalog = LoadBenchCatalog(argc > 5 ? argv[5] : NULL);
+		if (catalog) {
+			RunSweep(argc > 2 ? atoi(argv[2]) : 200, argc > 3 ? atoi(argv[3]) : 0, argc > 4 ? argv[4] : "sweep_results.csv", catalog);
+		}
+		return catalog ? 0 : 1;
+	}
+	if (argc > 1 && strcmp(argv[1], "export") == 0) {
+		BenchExport(argc > 2 ? argv[2] : NULL);
+		return 0;
+	}
+	if (argc > 1 && strcmp(argv[1], "mix") == 0) {
+		BenchTileMix(argc > 2 ? atoi(argv[2]) : 500, argc > 3 ? argv[3] : NULL);
+		return 0;
+	}
+	if (argc > 1 && strcmp(argv[1], "tiles") == 0) {
+		BenchTileLoad(argc > 2 ? argv[2] : ".", argc > 3 ? atoi(argv[3]) : 20);
+		return 0;
+	}
+	if (argc > 1 && strcmp(argv[1], "scale") == 0) {
+		return BenchScale() ? 0 : 1;
+	}
+	if (argc > 1 && strcmp(argv[1], "world") == 0) {
+		BenchWorld(argc > 2 ? atoi(argv[2]) : 200);
+		return 0;
+	}
+	if (argc > 1 && strcmp(argv[1], "alloc") == 0) {
+		return CheckAllocations() ? 0 : 1;
+	}
+	if (argc > 1 && strcmp(argv[1], "batch") == 0) {
+		unsigned int count = argc > 2 ? atoi(argv[2]) : 10000;
+		unsigned int threads = argc > 3 ? atoi(argv[3]) : 0;
+		TileCatalogPtr catalog = LoadBenchCatalog(argc > 4 ? argv[4] : NULL);
+		if (catalog) {
+			BenchBatch(count, threads, catalog);
+		}
+		return catalog ? 0 : 1;
+	}
+
 	Graph graph;
 	const int n = 10;
 	const unsigned int node_count = 22;
 	IndexVec path;
 
-	LARGE_INTEGER temp;
-	::QueryPerformanceFrequency(&temp);
-	double reci_freq = (1000.0 / temp.QuadPart);
-	LARGE_INTEGER start;
-	::QueryPerformanceCounter(&start);
+	double start = GetTimeMs();
 
 	int cnt = 0;
 	for (int i = 0; i < n; ++i)	{
@@ -830,14 +5613,13 @@ int main()
 		graph.FindPath(0, node_count-1, path);
 	}
 
-	LARGE_INTEGER end;
-	::QueryPerformanceCounter(&end);
-	float t = (float)((end.QuadPart - start.QuadPart) * reci_freq);
+	float t = (float)(GetTimeMs() - start);
 
 	cout<<"total time(ms): "<<t<<endl;
 	cout<<"average time(ms): "<<t/n<<endl;
 
 	cout<<"MaxCnt = "<<cnt<<endl;
+	cout<<"seed = "<<graph.GetSeed()<<endl;
 	
 	graph.Print();
 
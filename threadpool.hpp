@@ -0,0 +1,107 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// runs job(worker, index) for every index of [0, count) on a fixed number of workers.
+// each worker starts with a contiguous slice of the indices and takes work from the back
+// of its own queue, a worker that runs dry steals from the front of the other queues
+class WorkStealingPool{
+	struct Queue{
+		std::mutex lock;
+		std::deque<unsigned int> jobs;
+	};
+	typedef std::function<void(unsigned int, unsigned int)> Job;
+
+	unsigned int m_threads;
+	std::vector<Queue*> m_queues;
+private:
+	bool Pop(unsigned int worker, unsigned int &index);
+	bool Steal(unsigned int worker, unsigned int &index);
+	void Work(unsigned int worker, const Job &job);
+public:
+	explicit WorkStealingPool(unsigned int threads = 0);
+	~WorkStealingPool();
+	unsigned int GetThreadCount() const { return m_threads; }
+	void Run(unsigned int count, const Job &job);
+};
+
+inline WorkStealingPool::WorkStealingPool(unsigned int threads) : m_threads(threads)
+{
+	if (m_threads == 0) {
+		m_threads = std::thread::hardware_concurrency();
+	}
+	if (m_threads == 0) {
+		m_threads = 1;
+	}
+	for (unsigned int i = 0; i < m_threads; ++i) {
+		m_queues.push_back(new Queue);
+	}
+}
+
+inline WorkStealingPool::~WorkStealingPool()
+{
+	for (unsigned int i = 0; i < m_queues.size(); ++i) {
+		delete m_queues[i];
+	}
+	m_queues.clear();
+}
+
+inline bool WorkStealingPool::Pop(unsigned int worker, unsigned int &index)
+{
+	Queue &queue = *m_queues[worker];
+	std::lock_guard<std::mutex> guard(queue.lock);
+	if (queue.jobs.empty()) {
+		return false;
+	}
+	index = queue.jobs.back();
+	queue.jobs.pop_back();
+	return true;
+}
+
+inline bool WorkStealingPool::Steal(unsigned int worker, unsigned int &index)
+{
+	for (unsigned int i = 1; i < m_threads; ++i) {
+		Queue &queue = *m_queues[(worker + i) % m_threads];
+		std::lock_guard<std::mutex> guard(queue.lock);
+		if (!queue.jobs.empty()) {
+			index = queue.jobs.front();
+			queue.jobs.pop_front();
+			return true;
+		}
+	}
+	return false;
+}
+
+inline void WorkStealingPool::Work(unsigned int worker, const Job &job)
+{
+	unsigned int index = 0;
+	while (Pop(worker, index) || Steal(worker, index)) {
+		job(worker, index);
+	}
+}
+
+// blocks until every job has finished, the calling thread works as worker 0
+inline void WorkStealingPool::Run(unsigned int count, const Job &job)
+{
+	for (unsigned int w = 0; w < m_threads; ++w) {
+		unsigned int begin = (unsigned int)((unsigned long long)count * w / m_threads);
+		unsigned int end = (unsigned int)((unsigned long long)count * (w + 1) / m_threads);
+		// reversed, so the owner pops its slice in ascending order
+		for (unsigned int i = end; i > begin; --i) {
+			m_queues[w]->jobs.push_back(i - 1);
+		}
+	}
+
+	std::vector<std::thread> workers;
+	for (unsigned int w = 1; w < m_threads; ++w) {
+		workers.push_back(std::thread(&WorkStealingPool::Work, this, w, std::cref(job)));
+	}
+	Work(0, job);
+	for (unsigned int i = 0; i < workers.size(); ++i) {
+		workers[i].join();
+	}
+}